@@ -0,0 +1,127 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * class CountMinSketch
+ *
+ * Counts how often things (identified by a 64 bit hash) were added using
+ * a fixed amount of memory. The count returned by estimate() is never
+ * smaller than the real count, but it can be larger if other things share
+ * counters with it. Counters are updated conservatively (only those that
+ * are at the minimum are incremented), which keeps this error small.
+ *
+ * With W counters per row and N things added in total, an estimate is at
+ * most e * N / W too large with a probability of 1 - e^-depth (98%). So
+ * the width has to be chosen depending on the size of the input.
+ */
+class CountMinSketch {
+
+public:
+
+    /// Number of rows.
+    static constexpr const std::size_t depth = 4;
+
+private:
+
+    std::size_t m_mask;
+
+    std::vector<uint32_t> m_counters;
+
+    // Double hashing: derive the counter for each row from the two halves
+    // of the hash.
+    std::size_t index(uint64_t hash, std::size_t row) const noexcept {
+        const auto h1 = static_cast<std::size_t>(hash);
+        const auto h2 = static_cast<std::size_t>(hash >> 32U) | 1U;
+        return row * (m_mask + 1) + ((h1 + row * h2) & m_mask);
+    }
+
+public:
+
+    /**
+     * Create sketch with the given number of counters per row, rounded
+     * up to the next power of two.
+     */
+    explicit CountMinSketch(std::size_t width) {
+        std::size_t size = 1;
+        while (size < width) {
+            size <<= 1U;
+        }
+        m_mask = size - 1;
+        m_counters.resize(depth * size);
+    }
+
+    /**
+     * Hash function for a pair of numbers. This uses the finalizer from
+     * MurmurHash3 to get well-mixed bits.
+     */
+    static uint64_t hash(uint64_t a, uint64_t b) noexcept {
+        uint64_t h = a * 0x9e3779b97f4a7c15ULL ^ b;
+        h ^= h >> 33U;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33U;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33U;
+        return h;
+    }
+
+    uint32_t estimate(uint64_t hash) const noexcept {
+        uint32_t min = std::numeric_limits<uint32_t>::max();
+        for (std::size_t row = 0; row < depth; ++row) {
+            min = std::min(min, m_counters[index(hash, row)]);
+        }
+        return min;
+    }
+
+    /**
+     * Add one to the count for the hash and return the new estimate.
+     */
+    uint32_t add(uint64_t hash) noexcept {
+        const uint32_t min = estimate(hash);
+        if (min == std::numeric_limits<uint32_t>::max()) {
+            return min;
+        }
+        for (std::size_t row = 0; row < depth; ++row) {
+            auto& counter = m_counters[index(hash, row)];
+            if (counter == min) {
+                ++counter;
+            }
+        }
+        return min + 1;
+    }
+
+    /// Width of a sketch using the given number of bytes (rounded down).
+    static std::size_t width_for_size(std::size_t bytes) noexcept {
+        return bytes / (depth * sizeof(uint32_t));
+    }
+
+    std::size_t bytes_used() const noexcept {
+        return m_counters.capacity() * sizeof(uint32_t);
+    }
+
+}; // class CountMinSketch
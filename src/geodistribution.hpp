@@ -26,7 +26,15 @@
 
 #include <gd.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <stdexcept>
@@ -50,42 +58,155 @@ class MapToInt {
     unsigned int m_width;
     unsigned int m_height;
 
-    double m_dx;
-    double m_dy;
+    // The bounding box in the fixed-point coordinates osmium uses
+    // internally (see osmium::Location::x() and y()).
+    int32_t m_minx_fix;
+    int32_t m_miny_fix;
+    int32_t m_maxx_fix;
+    int32_t m_maxy_fix;
+
+    // Width and height of the bounding box in fixed-point units.
+    double m_dx_fix;
+    double m_dy_fix;
+
+    // Number of cells per fixed-point unit.
+    double m_scale_x;
+    double m_scale_y;
+
+    /**
+     * Returns the smallest fixed-point coordinate x for which
+     * x / coordinate_precision >= coordinate, so comparing with the integer
+     * coordinates gives the same result as comparing osmium::Location::lon()
+     * or lat() with the coordinate. (The product coordinate * precision is
+     * itself rounded, so rounding it up isn't enough.)
+     */
+    static int32_t to_fix(double coordinate, int32_t limit) noexcept {
+        auto c = static_cast<int64_t>(std::llround(coordinate * osmium::detail::coordinate_precision));
+        if (static_cast<double>(c) / osmium::detail::coordinate_precision < coordinate) {
+            ++c;
+        }
+        return static_cast<int32_t>(std::max<int64_t>(-limit, std::min<int64_t>(c, limit)));
+    }
+
+    /**
+     * Returns the cell for a distance (in fixed-point units) from the edge
+     * of the bounding box, ie. floor(distance * cells / size) clamped to
+     * cells - 1. The scale is rounded up to the next double, this way the
+     * product is never smaller than the exact value and, as long as
+     * cells * size < 2^51, never reaches the next integer if the exact value
+     * doesn't, so the result is exact.
+     */
+    static uint32_t to_cell(uint32_t distance, double scale, unsigned int cells) noexcept {
+        return std::min(static_cast<uint32_t>(distance * scale), cells - 1);
+    }
 
 public:
 
     MapToInt(double minx, double miny, double maxx, double maxy, unsigned int width, unsigned int height) :
         m_minx(minx), m_miny(miny), m_maxx(maxx), m_maxy(maxy),
         m_width(width), m_height(height),
-        m_dx(maxx - minx), m_dy(maxy - miny) {
+        m_minx_fix(to_fix(minx, 180 * osmium::detail::coordinate_precision)),
+        m_miny_fix(to_fix(miny, 90 * osmium::detail::coordinate_precision)),
+        m_maxx_fix(to_fix(maxx, 180 * osmium::detail::coordinate_precision)),
+        m_maxy_fix(to_fix(maxy, 90 * osmium::detail::coordinate_precision)),
+        m_dx_fix(static_cast<double>(static_cast<int64_t>(m_maxx_fix) - m_minx_fix)),
+        m_dy_fix(static_cast<double>(static_cast<int64_t>(m_maxy_fix) - m_miny_fix)),
+        m_scale_x(std::nextafter(width / m_dx_fix, std::numeric_limits<double>::max())),
+        m_scale_y(std::nextafter(height / m_dy_fix, std::numeric_limits<double>::max())) {
         assert(size() < std::numeric_limits<uint32_t>::max());
+        assert(m_dx_fix * width < std::ldexp(1.0, 51) && m_dy_fix * height < std::ldexp(1.0, 51));
+    }
+
+    /**
+     * Is the location inside the bounding box? Always false for invalid
+     * locations.
+     */
+    bool contains(const osmium::Location& p) const noexcept {
+        return p.x() >= m_minx_fix && p.y() >= m_miny_fix &&
+               p.x() < m_maxx_fix && p.y() < m_maxy_fix;
     }
 
+    /**
+     * Map a location to a cell number. Works directly on the fixed-point
+     * coordinates of the location. Because the bounding box is always
+     * inside the range of valid coordinates, this also returns MAXINT for
+     * invalid locations.
+     */
     uint32_t operator()(const osmium::Location& p) const noexcept {
-        if (!p.valid() || p.lon_without_check() < m_minx
-                       || p.lat_without_check() < m_miny
-                       || p.lon_without_check() >= m_maxx
-                       || p.lat_without_check() >= m_maxy) {
+        if (!contains(p)) {
             // if the position is out of bounds we return MAXINT
             return std::numeric_limits<uint32_t>::max();
         }
 
-        auto x = static_cast<int>((p.lon_without_check() - m_minx) / m_dx * m_width);
-        auto y = static_cast<int>((m_maxy - p.lat_without_check()) / m_dy * m_height);
+        const auto x = to_cell(static_cast<uint32_t>(static_cast<int64_t>(p.x()) - m_minx_fix), m_scale_x, m_width);
+        const auto y = to_cell(static_cast<uint32_t>(static_cast<int64_t>(m_maxy_fix) - p.y()), m_scale_y, m_height);
+
+        return y * m_width + x;
+    }
 
-        if (x < 0) {
-            x = 0;
-        } else if (static_cast<unsigned int>(x) >= m_width) {
-            x = static_cast<int>(m_width) - 1;
+    /**
+     * Map count locations to cells, the result for each location is the
+     * same as from the operator() for a single location. With SSE2 this
+     * handles two locations at a time.
+     */
+    void operator()(const osmium::Location* locations, std::size_t count, uint32_t* cells) const noexcept {
+        std::size_t i = 0;
+
+#ifdef __SSE2__
+        const __m128i lo = _mm_set_epi32(m_miny_fix, m_minx_fix, m_miny_fix, m_minx_fix);
+        const __m128i hi = _mm_set_epi32(m_maxy_fix - 1, m_maxx_fix - 1, m_maxy_fix - 1, m_maxx_fix - 1);
+        const __m128d scale_x = _mm_set1_pd(m_scale_x);
+        const __m128d scale_y = _mm_set1_pd(m_scale_y);
+        const __m128d max_x = _mm_set1_pd(m_width - 1);
+        const __m128d max_y = _mm_set1_pd(m_height - 1);
+
+        for (; i + 2 <= count; i += 2) {
+            const __m128i v = _mm_set_epi32(locations[i + 1].y(), locations[i + 1].x(),
+                                            locations[i].y(), locations[i].x());
+
+            // all bits set in lanes 0 and 2 if the location is outside the bbox
+            __m128i outside = _mm_or_si128(_mm_cmplt_epi32(v, lo), _mm_cmpgt_epi32(v, hi));
+            outside = _mm_or_si128(outside, _mm_srli_epi64(outside, 32));
+
+            // x coordinates in lanes 0 and 1, y coordinates in lanes 2 and 3
+            const __m128i xy = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+            const __m128d dx = _mm_sub_pd(_mm_cvtepi32_pd(xy), _mm_set1_pd(m_minx_fix));
+            const __m128d dy = _mm_sub_pd(_mm_set1_pd(m_maxy_fix), _mm_cvtepi32_pd(_mm_srli_si128(xy, 8)));
+
+            // same as to_cell(), but truncating is done in the conversion below
+            const __m128d x = _mm_min_pd(_mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_mul_pd(dx, scale_x))), max_x);
+            const __m128d y = _mm_min_pd(_mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_mul_pd(dy, scale_y))), max_y);
+
+            // y * width + x can be larger than the largest int32_t, so shift
+            // it into the signed range for the conversion and back
+            const __m128d cell = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(y, _mm_set1_pd(m_width)), x), _mm_set1_pd(2147483648.0));
+            __m128i result = _mm_xor_si128(_mm_cvttpd_epi32(cell), _mm_set1_epi32(std::numeric_limits<int32_t>::min()));
+
+            result = _mm_or_si128(result, _mm_shuffle_epi32(outside, _MM_SHUFFLE(3, 3, 2, 0)));
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(cells + i), result);
         }
-        if (y < 0) {
-            y = 0;
-        } else if (static_cast<unsigned int>(y) >= m_height) {
-            y = static_cast<int>(m_height) - 1;
+#endif
+
+        for (; i < count; ++i) {
+            cells[i] = (*this)(locations[i]);
         }
+    }
+
+    double minx() const noexcept {
+        return m_minx;
+    }
+
+    double miny() const noexcept {
+        return m_miny;
+    }
+
+    double maxx() const noexcept {
+        return m_maxx;
+    }
 
-        return static_cast<unsigned int>(y) * m_width + static_cast<unsigned int>(x);
+    double maxy() const noexcept {
+        return m_maxy;
     }
 
     unsigned int width() const noexcept {
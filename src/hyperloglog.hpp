@@ -0,0 +1,166 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * class HyperLogLog
+ *
+ * Estimates the number of distinct strings added to it using a fixed amount
+ * of memory. Two sketches can be merged, the result is the same as if all
+ * strings had been added to one sketch.
+ *
+ * As long as only few distinct strings were added, their hashes are kept in
+ * a sorted vector and the count is exact. Once that would use more memory
+ * than the registers, the sketch switches to the usual dense representation
+ * with 2^precision one-byte registers (standard error about 3%).
+ */
+class HyperLogLog {
+
+    static constexpr const unsigned int precision = 10;
+    static constexpr const std::size_t num_registers = 1U << precision;
+    static constexpr const std::size_t max_sparse = num_registers / sizeof(uint64_t);
+
+    std::vector<uint64_t> m_sparse;
+
+    std::vector<uint8_t> m_registers;
+
+    void add_to_registers(uint64_t hash) noexcept {
+        const auto idx = hash >> (64U - precision);
+        uint64_t rest = hash << precision;
+        uint8_t rank = 1;
+        while (rank <= 64U - precision && !(rest & (1ULL << 63U))) {
+            ++rank;
+            rest <<= 1U;
+        }
+        if (m_registers[idx] < rank) {
+            m_registers[idx] = rank;
+        }
+    }
+
+    void make_dense() {
+        m_registers.resize(num_registers);
+        for (const auto hash : m_sparse) {
+            add_to_registers(hash);
+        }
+        m_sparse.clear();
+        m_sparse.shrink_to_fit();
+    }
+
+public:
+
+    /**
+     * Hash function used for the strings. This is FNV-1a with the
+     * finalizer from MurmurHash3 to get well-mixed high bits.
+     */
+    static uint64_t hash(const char* str) noexcept {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (; *str; ++str) {
+            h ^= static_cast<unsigned char>(*str);
+            h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 33U;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33U;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33U;
+        return h;
+    }
+
+    bool dense() const noexcept {
+        return !m_registers.empty();
+    }
+
+    void add_hash(uint64_t hash) {
+        if (dense()) {
+            add_to_registers(hash);
+            return;
+        }
+
+        const auto it = std::lower_bound(m_sparse.begin(), m_sparse.end(), hash);
+        if (it != m_sparse.end() && *it == hash) {
+            return;
+        }
+        m_sparse.insert(it, hash);
+
+        if (m_sparse.size() > max_sparse) {
+            make_dense();
+        }
+    }
+
+    void add(const char* str) {
+        add_hash(hash(str));
+    }
+
+    void merge(const HyperLogLog& other) {
+        if (!other.dense()) {
+            for (const auto hash : other.m_sparse) {
+                add_hash(hash);
+            }
+            return;
+        }
+
+        if (!dense()) {
+            make_dense();
+        }
+        for (std::size_t i = 0; i < num_registers; ++i) {
+            m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+        }
+    }
+
+    /**
+     * Return the (estimated) number of distinct strings added.
+     */
+    uint64_t estimate() const noexcept {
+        if (!dense()) {
+            return m_sparse.size();
+        }
+
+        constexpr const double m = num_registers;
+        double sum = 0.0;
+        std::size_t zeros = 0;
+        for (const auto r : m_registers) {
+            sum += std::ldexp(1.0, -r);
+            if (r == 0) {
+                ++zeros;
+            }
+        }
+
+        const double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+        if (estimate <= 2.5 * m && zeros != 0) {
+            // use linear counting for small cardinalities
+            return static_cast<uint64_t>(std::llround(m * std::log(m / static_cast<double>(zeros))));
+        }
+
+        return static_cast<uint64_t>(std::llround(estimate));
+    }
+
+    std::size_t bytes_used() const noexcept {
+        return m_sparse.capacity() * sizeof(uint64_t) + m_registers.capacity();
+    }
+
+}; // class HyperLogLog
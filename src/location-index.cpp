@@ -0,0 +1,164 @@
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "geodistribution.hpp"
+#include "location-index.hpp"
+
+#include <osmium/util/file.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+/**
+ * Header at the start of a cell index file. All values are in native
+ * byte order, the file can only be used on the same architecture.
+ */
+struct cell_index_header {
+    char magic[8];
+    uint32_t value_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+    double minx;
+    double miny;
+    double maxx;
+    double maxy;
+};
+
+static constexpr const char cell_index_magic[8] = {'T', 'I', 'C', 'E', 'L', 'L', 'S', '2'};
+
+template <typename TValue>
+static std::unique_ptr<LocationIndex> create_location_index(const std::string& index_type_name) {
+    if (index_type_name == "FlexMem" || index_type_name == "DenseMemArray") {
+        return std::make_unique<LocationIndexImpl<TValue, osmium::index::map::DenseMemArray, true>>();
+    }
+    if (index_type_name == "SparseMemArray") {
+        return std::make_unique<LocationIndexImpl<TValue, osmium::index::map::SparseMemArray, false>>();
+    }
+#ifdef __linux__
+    if (index_type_name == "DenseMmapArray") {
+        return std::make_unique<LocationIndexImpl<TValue, osmium::index::map::DenseMmapArray, true>>();
+    }
+    if (index_type_name == "SparseMmapArray") {
+        return std::make_unique<LocationIndexImpl<TValue, osmium::index::map::SparseMmapArray, false>>();
+    }
+#endif
+
+    throw std::runtime_error{"Support for map type '" + index_type_name + "' not compiled into this binary."};
+}
+
+std::unique_ptr<LocationIndex> LocationIndex::create(const std::string& index_type_name, bool better_resolution) {
+    if (better_resolution) {
+        return create_location_index<uint32_t>(index_type_name);
+    }
+    return create_location_index<uint16_t>(index_type_name);
+}
+
+static osmium::util::MemoryMapping map_cell_index_file(const std::string& filename) {
+    const int fd = ::open(filename.c_str(), O_RDONLY); // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    if (fd < 0) {
+        throw std::system_error{errno, std::system_category(), "Can not open cell index file '" + filename + "'"};
+    }
+
+    try {
+        const auto size = osmium::file_size(fd);
+        if (size < sizeof(cell_index_header)) {
+            throw std::runtime_error{"File '" + filename + "' is not a cell index file"};
+        }
+        osmium::util::MemoryMapping mapping{size, osmium::util::MemoryMapping::mapping_mode::readonly, fd};
+        ::close(fd);
+        return mapping;
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+std::unique_ptr<LocationIndex> LocationIndex::open(const std::string& filename, const MapToInt& map_to_int) {
+    auto mapping = map_cell_index_file(filename);
+
+    cell_index_header header; // NOLINT(cppcoreguidelines-pro-type-member-init,hicpp-member-init)
+    std::memcpy(&header, mapping.get_addr<char>(), sizeof(header));
+
+    if (!std::equal(std::begin(cell_index_magic), std::end(cell_index_magic), std::begin(header.magic)) ||
+        (header.value_size != sizeof(uint16_t) && header.value_size != sizeof(uint32_t)) ||
+        (mapping.size() - sizeof(header)) % header.value_size != 0) {
+        throw std::runtime_error{"File '" + filename + "' is not a cell index file"};
+    }
+
+    if (header.width != map_to_int.width() || header.height != map_to_int.height() ||
+        header.minx != map_to_int.minx() || header.miny != map_to_int.miny() ||
+        header.maxx != map_to_int.maxx() || header.maxy != map_to_int.maxy()) {
+        throw std::runtime_error{"Cell index file '" + filename + "' was created for a different bounding box or size"};
+    }
+
+    if (header.value_size == sizeof(uint32_t)) {
+        return std::make_unique<MappedLocationIndex<uint32_t>>(std::move(mapping), sizeof(header));
+    }
+    return std::make_unique<MappedLocationIndex<uint16_t>>(std::move(mapping), sizeof(header));
+}
+
+void LocationIndex::write(const std::string& filename, const MapToInt& map_to_int) {
+    cell_index_header header{};
+    std::copy(std::begin(cell_index_magic), std::end(cell_index_magic), std::begin(header.magic));
+    header.value_size = static_cast<uint32_t>(value_size());
+    header.width = map_to_int.width();
+    header.height = map_to_int.height();
+    header.minx = map_to_int.minx();
+    header.miny = map_to_int.miny();
+    header.maxx = map_to_int.maxx();
+    header.maxy = map_to_int.maxy();
+
+    // Write to a temporary file and rename it at the end, so that an index
+    // currently mapped from the same file is not truncated under us.
+    const std::string tmp_filename{filename + ".tmp"};
+    std::ofstream out{tmp_filename, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        throw std::runtime_error{"Can not open cell index file '" + tmp_filename + "' for writing"};
+    }
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_values(out);
+    out.close();
+
+    if (!out) {
+        throw std::runtime_error{"Error writing cell index file '" + tmp_filename + "'"};
+    }
+
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        throw std::system_error{errno, std::system_category(), "Can not rename cell index file '" + tmp_filename + "' to '" + filename + "'"};
+    }
+}
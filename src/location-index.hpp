@@ -0,0 +1,362 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "geodistribution.hpp"
+
+#include <osmium/index/index.hpp>
+#include <osmium/index/map/dense_mem_array.hpp>
+#include <osmium/index/map/dense_mmap_array.hpp>
+#include <osmium/index/map/sparse_mem_array.hpp>
+#include <osmium/index/map/sparse_mmap_array.hpp>
+#include <osmium/osm/way.hpp>
+#include <osmium/util/memory_mapping.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Stores the location of nodes. Lookup is by node ID.
+ *
+ * Locations are stored with reduced resolution, either in 16 bit or 32 bit.
+ * Use create() to get an index for the index type and resolution wanted.
+ * The implementations for the different configurations are instantiated
+ * from the LocationIndexImpl template, so the calls into the osmium maps
+ * don't go through a virtual function and can be inlined.
+ *
+ * The maps store the cell number plus one, so that 0 (the empty value of
+ * the osmium maps) always means "no location" and cell 0 can be told apart
+ * from it. All functions take and return the cell number itself.
+ *
+ * The index can be written to a cell index file with write() and used
+ * again later with open(). The file contains a small header describing
+ * the grid used (see MapToInt) followed by the stored values for all node
+ * IDs from 0 to the largest ID as an array. The array is memory mapped
+ * when the file is opened, so it doesn't have to be read completely.
+ */
+class LocationIndex {
+
+public:
+
+    /// Returned by get_noexcept() if there is no value for an id.
+    static constexpr const uint32_t invalid_value = std::numeric_limits<uint32_t>::max();
+
+protected:
+
+    // Number of way nodes get_cells() looks ahead for prefetching.
+    static constexpr const std::size_t prefetch_distance = 8;
+
+    template <typename TValue>
+    static void prefetch(const TValue* data, std::size_t size, osmium::unsigned_object_id_type id) noexcept {
+#ifdef __GNUC__
+        if (id < size) {
+            __builtin_prefetch(data + id);
+        }
+#endif
+    }
+
+    /**
+     * Look up all nodes in the array. The location of the node
+     * prefetch_distance positions ahead is prefetched, so that the random
+     * accesses into the (large) array don't have to wait for the memory
+     * one after the other.
+     */
+    template <typename TValue>
+    static std::size_t get_cells(const TValue* data, std::size_t size, const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells) {
+        const std::size_t num_nodes = nodes.size();
+        std::size_t missing = 0;
+
+        for (std::size_t i = 0; i < prefetch_distance && i < num_nodes; ++i) {
+            prefetch(data, size, nodes[i].positive_ref());
+        }
+
+        for (std::size_t i = 0; i < num_nodes; ++i) {
+            if (i + prefetch_distance < num_nodes) {
+                prefetch(data, size, nodes[i + prefetch_distance].positive_ref());
+            }
+            const auto id = nodes[i].positive_ref();
+            const uint32_t value = id < size ? data[id] : 0;
+            if (value == 0) {
+                ++missing;
+            } else {
+                cells.push_back(value - 1);
+            }
+        }
+
+        return missing;
+    }
+
+    /// Convert a value stored in a map to a cell number.
+    static uint32_t to_cell(uint32_t value) noexcept {
+        return value == 0 ? invalid_value : value - 1;
+    }
+
+    /// Size of one value in bytes.
+    virtual std::size_t value_size() const noexcept = 0;
+
+    /// Write all values as an array indexed by node ID to the stream.
+    virtual void write_values(std::ostream& out) = 0;
+
+public:
+
+    LocationIndex() = default;
+
+    LocationIndex(const LocationIndex&) = delete;
+    LocationIndex& operator=(const LocationIndex&) = delete;
+
+    LocationIndex(LocationIndex&&) = delete;
+    LocationIndex& operator=(LocationIndex&&) = delete;
+
+    virtual ~LocationIndex() = default;
+
+    /**
+     * Create a location index using the osmium map type with the given
+     * name. If better_resolution is set, values are stored in 32 bit,
+     * otherwise in 16 bit.
+     *
+     * @throws std::runtime_error if the index type is not available.
+     */
+    static std::unique_ptr<LocationIndex> create(const std::string& index_type_name, bool better_resolution);
+
+    /**
+     * Open a cell index file written by write(). The resulting index is
+     * read-only.
+     *
+     * @throws std::runtime_error if the file can not be read, is not a
+     *         cell index file, or was written for a different grid than
+     *         the one described by map_to_int.
+     */
+    static std::unique_ptr<LocationIndex> open(const std::string& filename, const MapToInt& map_to_int);
+
+    /**
+     * Write this index to a cell index file. The map_to_int must be the
+     * one used for creating the values. The file is written under a
+     * temporary name and then renamed, so it can be the file this index
+     * was opened from.
+     *
+     * @throws std::runtime_error if the file can not be written.
+     */
+    void write(const std::string& filename, const MapToInt& map_to_int);
+
+    /// Is this a read-only index (see open())?
+    virtual bool read_only() const noexcept {
+        return false;
+    }
+
+    virtual void set(osmium::unsigned_object_id_type id, uint32_t value) = 0;
+
+    virtual uint32_t get(osmium::unsigned_object_id_type id) const = 0;
+
+    /**
+     * Like get(), but returns invalid_value instead of throwing
+     * osmium::not_found if there is no value for the id.
+     */
+    virtual uint32_t get_noexcept(osmium::unsigned_object_id_type id) const noexcept = 0;
+
+    /**
+     * Look up the locations of all nodes in the list and append the
+     * values found to cells. Returns the number of nodes without a cell,
+     * because they were not in the input or outside the bounding box.
+     */
+    virtual std::size_t get_cells(const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells) const = 0;
+
+    virtual size_t size() const noexcept = 0;
+
+    virtual size_t used_memory() const noexcept = 0;
+
+}; // class LocationIndex
+
+/**
+ * Location index storing values of type TValue in the osmium map TMap.
+ * If TDense is set, TMap must be one of the dense array maps, get_cells()
+ * then accesses the array directly.
+ */
+template <typename TValue, template <typename, typename> class TMap, bool TDense>
+class LocationIndexImpl final : public LocationIndex {
+
+    TMap<osmium::unsigned_object_id_type, TValue> m_map;
+
+    std::size_t get_cells(const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells, std::true_type /*dense*/) const {
+        const std::size_t size = m_map.size();
+        if (size == 0) {
+            return nodes.size();
+        }
+        return LocationIndex::get_cells(&*m_map.cbegin(), size, nodes, cells);
+    }
+
+    std::size_t get_cells(const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells, std::false_type /*dense*/) const {
+        std::size_t missing = 0;
+        for (const auto& wn : nodes) {
+            const uint32_t value = m_map.get_noexcept(wn.positive_ref());
+            if (value == 0) {
+                ++missing;
+            } else {
+                cells.push_back(value - 1);
+            }
+        }
+        return missing;
+    }
+
+    void write_values(std::ostream& out, std::true_type /*dense*/) {
+        if (m_map.size() > 0) {
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            out.write(reinterpret_cast<const char*>(&*m_map.cbegin()), static_cast<std::streamsize>(m_map.size() * sizeof(TValue)));
+        }
+    }
+
+    void write_values(std::ostream& out, std::false_type /*dense*/) {
+        const TValue zero = 0;
+        osmium::unsigned_object_id_type next_id = 0;
+        m_map.sort();
+        for (auto it = m_map.cbegin(); it != m_map.cend(); ++it) {
+            if (it->first < next_id) { // duplicate id
+                continue;
+            }
+            for (; next_id < it->first; ++next_id) {
+                // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+                out.write(reinterpret_cast<const char*>(&zero), sizeof(TValue));
+            }
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            out.write(reinterpret_cast<const char*>(&it->second), sizeof(TValue));
+            ++next_id;
+        }
+    }
+
+protected:
+
+    std::size_t value_size() const noexcept override {
+        return sizeof(TValue);
+    }
+
+    void write_values(std::ostream& out) override {
+        write_values(out, std::integral_constant<bool, TDense>{});
+    }
+
+public:
+
+    void set(osmium::unsigned_object_id_type id, uint32_t value) override {
+        if (value == invalid_value) {
+            return;
+        }
+        assert(value < std::numeric_limits<TValue>::max());
+        m_map.set(id, static_cast<TValue>(value + 1));
+    }
+
+    uint32_t get(osmium::unsigned_object_id_type id) const override {
+        return m_map.get(id) - 1U;
+    }
+
+    uint32_t get_noexcept(osmium::unsigned_object_id_type id) const noexcept override {
+        return to_cell(m_map.get_noexcept(id));
+    }
+
+    std::size_t get_cells(const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells) const override {
+        return get_cells(nodes, cells, std::integral_constant<bool, TDense>{});
+    }
+
+    size_t size() const noexcept override {
+        return m_map.size();
+    }
+
+    size_t used_memory() const noexcept override {
+        return m_map.used_memory();
+    }
+
+}; // class LocationIndexImpl
+
+/**
+ * Read-only location index using the array in a memory mapped cell index
+ * file. Created by LocationIndex::open().
+ */
+template <typename TValue>
+class MappedLocationIndex final : public LocationIndex {
+
+    osmium::util::MemoryMapping m_mapping;
+    const TValue* m_data;
+    std::size_t m_size;
+
+protected:
+
+    std::size_t value_size() const noexcept override {
+        return sizeof(TValue);
+    }
+
+    void write_values(std::ostream& out) override {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        out.write(reinterpret_cast<const char*>(m_data), static_cast<std::streamsize>(m_size * sizeof(TValue)));
+    }
+
+public:
+
+    /**
+     * Use the mapping of a cell index file. The values start at offset
+     * from the beginning of the mapping.
+     */
+    MappedLocationIndex(osmium::util::MemoryMapping&& mapping, std::size_t offset) :
+        m_mapping(std::move(mapping)),
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        m_data(reinterpret_cast<const TValue*>(m_mapping.get_addr<char>() + offset)),
+        m_size((m_mapping.size() - offset) / sizeof(TValue)) {
+    }
+
+    bool read_only() const noexcept override {
+        return true;
+    }
+
+    void set(osmium::unsigned_object_id_type /*id*/, uint32_t /*value*/) override {
+        throw std::runtime_error{"Can not change read-only location index"};
+    }
+
+    uint32_t get(osmium::unsigned_object_id_type id) const override {
+        const uint32_t value = id < m_size ? m_data[id] : 0;
+        if (value == 0) {
+            throw osmium::not_found{id};
+        }
+        return value - 1;
+    }
+
+    uint32_t get_noexcept(osmium::unsigned_object_id_type id) const noexcept override {
+        return to_cell(id < m_size ? m_data[id] : 0);
+    }
+
+    std::size_t get_cells(const osmium::WayNodeList& nodes, std::vector<uint32_t>& cells) const override {
+        return LocationIndex::get_cells(m_data, m_size, nodes, cells);
+    }
+
+    size_t size() const noexcept override {
+        return m_size;
+    }
+
+    size_t used_memory() const noexcept override {
+        return m_mapping.size();
+    }
+
+}; // class MappedLocationIndex
@@ -20,31 +20,176 @@
 */
 
 #include "statistics-handler.hpp"
+#include "util.hpp"
 
 #include <sqlite.hpp>
 
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/file.hpp>
+#include <osmium/memory/buffer.hpp>
+#include <osmium/thread/queue.hpp>
 #include <osmium/visitor.hpp>
 
+#include <getopt.h>
+
+#include <atomic>
 #include <exception>
+#include <future>
 #include <iostream>
+#include <utility>
+#include <vector>
+
+static void print_help() {
+    std::cout << "osmstats [OPTIONS] OSMFILE DATABASE\n\n" \
+              << "This program is part of taginfo. It calculates some basic statistics\n" \
+              << "from OSMFILE and writes them into the stats table of DATABASE (an SQLite\n" \
+              << "database).\n" \
+              << "\nOptions:\n" \
+              << "  -H, --help                    Print this help message and exit\n" \
+              << "  -M, --no-metadata             Do not read metadata (faster, but these statistics\n" \
+              << "                                will not be written:";
+    for (const auto* name : StatisticsHandler::metadata_stat_names()) {
+        std::cout << "\n                                  " << name;
+    }
+    std::cout << ")\n" \
+              << "  -t, --threads=NUM             Number of threads to use (default: 1)\n";
+}
+
+/**
+ * Read all buffers from the reader and hand them to num_threads workers
+ * with their own StatisticsHandler. All statistics are sums or maxima, so
+ * the order in which objects are seen doesn't matter. The statistics of
+ * the workers are merged into the handler at the end.
+ *
+ * The workers always take buffers from the queue until they get the end
+ * marker, even after an error, so that the reader never waits forever on a
+ * full queue. The end markers are pushed even if reading fails, so that the
+ * workers always finish. The first error is rethrown.
+ */
+static void apply_in_parallel(osmium::io::Reader& reader, StatisticsHandler& handler, unsigned int num_threads) {
+    osmium::thread::Queue<osmium::memory::Buffer> queue{num_threads * 4, "osmstats"};
+
+    // each worker gets a copy of the still empty handler
+    std::vector<StatisticsHandler> worker_handlers(num_threads, handler);
+
+    // set by a worker on error, so we can stop reading early
+    std::atomic<bool> failed{false};
+
+    std::vector<std::future<void>> futures;
+    for (auto& worker_handler : worker_handlers) {
+        futures.push_back(std::async(std::launch::async, [&queue, &worker_handler, &failed]() {
+            std::exception_ptr error;
+            while (true) {
+                osmium::memory::Buffer buffer;
+                queue.wait_and_pop(buffer);
+                if (!buffer) {
+                    // an invalid buffer signals the end of the data
+                    break;
+                }
+                if (error) {
+                    continue;
+                }
+                try {
+                    osmium::apply(buffer, worker_handler);
+                } catch (...) {
+                    error = std::current_exception();
+                    failed = true;
+                }
+            }
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }));
+    }
+
+    std::exception_ptr read_error;
+    try {
+        while (!failed) {
+            osmium::memory::Buffer buffer = reader.read();
+            if (!buffer) {
+                break;
+            }
+            queue.push(std::move(buffer));
+        }
+    } catch (...) {
+        read_error = std::current_exception();
+    }
+
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        queue.push(osmium::memory::Buffer{});
+    }
+
+    for (auto& future : futures) {
+        future.wait();
+    }
+
+    if (read_error) {
+        std::rethrow_exception(read_error);
+    }
+
+    for (auto& future : futures) {
+        future.get();
+    }
+
+    for (const auto& worker_handler : worker_handlers) {
+        handler.merge(worker_handler);
+    }
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " OSMFILE DATABASE\n";
+    static const option long_options[] = {
+        {"help",        no_argument,       nullptr, 'H'},
+        {"no-metadata", no_argument,       nullptr, 'M'},
+        {"threads",     required_argument, nullptr, 't'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    unsigned int num_threads = 1;
+    bool with_metadata = true;
+
+    while (true) {
+        // NOLINTNEXTLINE(concurrency-mt-unsafe)
+        const int c = getopt_long(argc, argv, "HMt:", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'H':
+                print_help();
+                return 0;
+            case 'M':
+                with_metadata = false;
+                break;
+            case 't':
+                num_threads = get_uint(optarg);
+                if (num_threads == 0) {
+                    num_threads = 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE DATABASE\n";
         return 1;
     }
 
     try {
-        const osmium::io::File input_file{argv[1]};
+        const osmium::io::File input_file{argv[optind]};
 
-        Sqlite::Database db{argv[2], SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE}; // NOLINT(hicpp-signed-bitwise)
+        Sqlite::Database db{argv[optind + 1], SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE}; // NOLINT(hicpp-signed-bitwise)
         db.exec("CREATE TABLE stats (key TEXT, value INT64);");
 
-        StatisticsHandler handler{db};
-        osmium::io::Reader reader{input_file};
-        osmium::apply(reader, handler);
+        StatisticsHandler handler{db, with_metadata};
+        osmium::io::Reader reader{input_file, with_metadata ? osmium::io::read_meta::yes : osmium::io::read_meta::no};
+        if (num_threads > 1) {
+            apply_in_parallel(reader, handler, num_threads);
+        } else {
+            osmium::apply(reader, handler);
+        }
 
         handler.write_to_database();
     } catch (const std::exception& e) {
@@ -54,4 +199,3 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
-
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <vector>
+
+/**
+ * Call func(begin, end, chunk) for consecutive chunks of the range [0, size)
+ * using num_threads threads. Each thread takes the next chunk not yet
+ * processed when it is done with the previous one.
+ */
+template <typename TFunc>
+inline void run_in_chunks(std::size_t size, std::size_t chunk_size, unsigned int num_threads, TFunc&& func) {
+    std::atomic<std::size_t> next_chunk{0};
+    const std::size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+
+    auto worker = [&]() {
+        for (std::size_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+            const std::size_t begin = chunk * chunk_size;
+            func(begin, std::min(begin + chunk_size, size), chunk);
+        }
+    };
+
+    std::vector<std::future<void>> futures;
+    for (unsigned int i = 1; i < num_threads; ++i) {
+        futures.push_back(std::async(std::launch::async, worker));
+    }
+    worker();
+
+    for (auto& future : futures) {
+        future.get();
+    }
+}
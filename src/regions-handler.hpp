@@ -0,0 +1,217 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "geodistribution.hpp"
+#include "location-index.hpp"
+#include "tagstats-handler.hpp"
+
+#include <sqlite.hpp>
+
+#include <osmium/handler.hpp>
+#include <osmium/index/id_set.hpp>
+#include <osmium/osm.hpp>
+#include <osmium/util/verbose_output.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Configuration of a region: the database its statistics are written to
+ * and its bounding box.
+ */
+struct region_config {
+    std::string database_name;
+    double left;
+    double bottom;
+    double right;
+    double top;
+};
+
+/**
+ * Options used for all regions. They are the same as for the main
+ * statistics.
+ */
+struct region_options {
+    std::string selection_database_name;
+    std::string index_type_name;
+    unsigned int min_tag_combination_count;
+    unsigned int min_key_combination_count;
+    bool prune_tag_combinations;
+    std::size_t sketch_width;
+    unsigned int width;
+    unsigned int height;
+};
+
+/**
+ * A region with its own database, location index, and TagStatsHandler.
+ */
+class Region {
+
+    std::string m_database_name;
+    Sqlite::Database m_database;
+    MapToInt m_map_to_int;
+    std::unique_ptr<LocationIndex> m_location_index;
+
+    // IDs of all ways in this region.
+    osmium::index::IdSetDense<osmium::unsigned_object_id_type> m_way_ids;
+
+    TagStatsHandler m_handler;
+
+    // The location index of a region only contains the nodes in it. A
+    // dense index would need memory for all node IDs in the input for
+    // every region, so the sparse variant of the index type is used.
+    static std::string sparse_index_type(const std::string& index_type_name) {
+        if (index_type_name == "DenseMmapArray" || index_type_name == "SparseMmapArray") {
+            return "SparseMmapArray";
+        }
+        return "SparseMemArray";
+    }
+
+public:
+
+    Region(const region_config& config, const region_options& options, osmium::util::VerboseOutput& vout) :
+        m_database_name(config.database_name),
+        m_database(config.database_name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE), // NOLINT(hicpp-signed-bitwise)
+        m_map_to_int(config.left, config.bottom, config.right, config.top, options.width, options.height),
+        m_location_index(LocationIndex::create(sparse_index_type(options.index_type_name), (options.width * options.height) >= (1U << 16U))),
+        m_handler(m_database, options.selection_database_name, m_map_to_int, options.min_tag_combination_count, options.min_key_combination_count, vout, *m_location_index, options.prune_tag_combinations, options.sketch_width) {
+    }
+
+    const std::string& database_name() const noexcept {
+        return m_database_name;
+    }
+
+    Sqlite::Database& database() noexcept {
+        return m_database;
+    }
+
+    TagStatsHandler& handler() noexcept {
+        return m_handler;
+    }
+
+    bool contains(const osmium::Node& node) const noexcept {
+        return m_map_to_int.contains(node.location());
+    }
+
+    /**
+     * A way is in the region if any of its nodes is. Call this only after
+     * all nodes have been processed.
+     */
+    bool contains(const osmium::Way& way) const noexcept {
+        return std::any_of(way.nodes().cbegin(), way.nodes().cend(), [this](const osmium::NodeRef& nr) {
+            return m_location_index->get_noexcept(nr.positive_ref()) != LocationIndex::invalid_value;
+        });
+    }
+
+    /**
+     * A relation is in the region if any of its node or way members is.
+     * Call this only after all ways have been processed.
+     */
+    bool contains(const osmium::Relation& relation) const noexcept {
+        return std::any_of(relation.members().cbegin(), relation.members().cend(), [this](const osmium::RelationMember& member) {
+            switch (member.type()) {
+                case osmium::item_type::node:
+                    return m_location_index->get_noexcept(member.positive_ref()) != LocationIndex::invalid_value;
+                case osmium::item_type::way:
+                    return m_way_ids.get(member.positive_ref());
+                default:
+                    return false;
+            }
+        });
+    }
+
+    void add_way(const osmium::Way& way) {
+        m_way_ids.set(way.positive_id());
+    }
+
+}; // class Region
+
+/**
+ * Osmium handler collecting tag statistics for several regions in one
+ * pass over the data. Each region has its own TagStatsHandler and writes
+ * to its own database, the result is similar to running taginfo-stats on
+ * an extract of the region.
+ *
+ * Nodes are in a region if their location is inside its bounding box.
+ * Ways and relations are in a region if any of their nodes or node and
+ * way members are (see Region::contains()). This is decided using the
+ * location index of the region, which only contains the nodes in it.
+ */
+class RegionsHandler : public osmium::handler::Handler {
+
+    std::vector<std::unique_ptr<Region>> m_regions;
+
+    osmium::item_type m_last_type = osmium::item_type::node;
+
+public:
+
+    RegionsHandler(const std::vector<region_config>& configs, const region_options& options, osmium::util::VerboseOutput& vout) {
+        m_regions.reserve(configs.size());
+        for (const auto& config : configs) {
+            vout << "Adding region '" << config.database_name << "'\n";
+            m_regions.push_back(std::make_unique<Region>(config, options, vout));
+        }
+    }
+
+    std::vector<std::unique_ptr<Region>>& regions() noexcept {
+        return m_regions;
+    }
+
+    void node(const osmium::Node& node) {
+        for (auto& region : m_regions) {
+            if (region->contains(node)) {
+                region->handler().node(node);
+            }
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (m_last_type != osmium::item_type::way) {
+            // make sure all node locations are in the location indexes
+            // before they are used in Region::contains()
+            for (auto& region : m_regions) {
+                region->handler().flush_location_batch();
+            }
+            m_last_type = osmium::item_type::way;
+        }
+
+        for (auto& region : m_regions) {
+            if (region->contains(way)) {
+                region->add_way(way);
+                region->handler().way(way);
+            }
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        for (auto& region : m_regions) {
+            if (region->contains(relation)) {
+                region->handler().relation(relation);
+            }
+        }
+    }
+
+}; // class RegionsHandler
@@ -0,0 +1,514 @@
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "parallel.hpp"
+#include "similarity.hpp"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+/**
+ * Compute Levenshtein edit distance. This is a very simple implementation of
+ * the Levenshtein algorithm I copied from somewhere on the Internet, but it
+ * is fast enough for our purpose here.
+ */
+static int edit_distance(const char* str1, std::size_t len1, const char* str2, std::size_t len2) noexcept {
+    thread_local static int d[MAX_STRLEN][MAX_STRLEN];
+
+    d[0][0] = 0;
+    for (std::size_t i = 1; i <= len1; ++i) {
+        d[i][0] = static_cast<int>(i);
+    }
+    for (std::size_t i = 1; i <= len2; ++i) {
+        d[0][i] = static_cast<int>(i);
+    }
+
+    for (std::size_t i = 1; i <= len1; ++i) {
+        for (std::size_t j = 1; j <= len2; ++j) {
+            d[i][j] = std::min(std::min(d[i - 1][j] + 1, d[i][j - 1] + 1),
+                               d[i - 1][j - 1] + (str1[i - 1] == str2[j - 1] ? 0 : 1));
+        }
+    }
+
+    return d[len1][len2];
+}
+
+/**
+ * Compute Levenshtein edit distance with the bit-parallel algorithm by
+ * Myers (in the formulation by Hyyrö). The first string must not be longer
+ * than 64 characters. If the distance is larger than max_distance, some
+ * value larger than max_distance is returned, possibly without looking at
+ * the whole second string.
+ */
+static int bounded_edit_distance(const char* str1, std::size_t len1, const char* str2, std::size_t len2, int max_distance) noexcept {
+    assert(len1 > 0 && len1 <= 64);
+
+    // Bit masks of the positions of each character in str1. Only the
+    // entries set here are non-zero, they are reset before returning.
+    thread_local static std::array<uint64_t, 256> peq{};
+
+    for (std::size_t i = 0; i < len1; ++i) {
+        peq[static_cast<unsigned char>(str1[i])] |= 1ULL << i;
+    }
+
+    const uint64_t last = 1ULL << (len1 - 1);
+    uint64_t pv = ~0ULL;
+    uint64_t mv = 0;
+    auto score = static_cast<int>(len1);
+
+    for (std::size_t j = 0; j < len2; ++j) {
+        const uint64_t eq = peq[static_cast<unsigned char>(str2[j])];
+        const uint64_t xv = eq | mv;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & last) {
+            ++score;
+        } else if (mh & last) {
+            --score;
+        }
+
+        ph = (ph << 1U) | 1U;
+        mh <<= 1U;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        // The score can go down by at most one for each remaining
+        // character, so stop early if we can't get below the limit.
+        if (score - static_cast<int>(len2 - j - 1) > max_distance) {
+            break;
+        }
+    }
+
+    for (std::size_t i = 0; i < len1; ++i) {
+        peq[static_cast<unsigned char>(str1[i])] = 0;
+    }
+
+    return score;
+}
+
+/**
+ * Does the haystack contain the needle? With SSE2 this compares the first
+ * and last character of the needle with 16 positions in the haystack at
+ * once and only does a full comparison where both match.
+ */
+static bool contains(const char* haystack, std::size_t hlen, const char* needle, std::size_t nlen) noexcept {
+    if (nlen == 0) {
+        return true;
+    }
+    if (nlen > hlen) {
+        return false;
+    }
+
+    std::size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+
+    for (; i + nlen - 1 + 16 <= hlen; i += 16) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + nlen - 1));
+        auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                      _mm_cmpeq_epi8(last, block_last))));
+        while (mask != 0) {
+            const auto bit = static_cast<unsigned int>(__builtin_ctz(mask));
+            if (std::memcmp(haystack + i + bit + 1, needle + 1, nlen - 1) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i + nlen <= hlen; ++i) {
+        if (haystack[i] == needle[0] && std::memcmp(haystack + i + 1, needle + 1, nlen - 1) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Are the two given strings similar according to some metric? The folded
+ * strings are case-folded copies of the strings.
+ */
+static int similarity(const char* str1, const char* folded1, std::size_t len1,
+                      const char* str2, const char* folded2, std::size_t len2) noexcept {
+    // Do not check very short strings, because they create too many false
+    // positives.
+    if (len1 < MIN_STRLEN || len2 < MIN_STRLEN) {
+        return -1;
+    }
+
+    // Do not check very long strings. This keeps memory use and run time for
+    // Levenshtein algorithm in check.
+    if (len1 >= MAX_STRLEN || len2 >= MAX_STRLEN) {
+        return -1;
+    }
+
+    // Check if one string is a substring of the other. This will also check
+    // if both strings differ only in case.
+    if (contains(folded1, len1, folded2, len2) || contains(folded2, len2, folded1, len1)) {
+        return 0;
+    }
+
+    // Do not check strings if they have very different lengths, they can't
+    // be similar according to Levenshtein anyway.
+    if (std::abs(static_cast<int64_t>(len1) - static_cast<int64_t>(len2)) >= MAX_EDIT_DISTANCE) {
+        return -1;
+    }
+
+    // Check Levenshtein edit distance. Use the faster bit-parallel version
+    // if one of the strings is short enough.
+    int distance = 0;
+    if (len1 <= 64) {
+        distance = bounded_edit_distance(str1, len1, str2, len2, MAX_EDIT_DISTANCE);
+    } else if (len2 <= 64) {
+        distance = bounded_edit_distance(str2, len2, str1, len1, MAX_EDIT_DISTANCE);
+    } else {
+        distance = edit_distance(str1, len1, str2, len2);
+    }
+    if (distance <= MAX_EDIT_DISTANCE) {
+        return distance;
+    }
+
+    return -1;
+}
+
+/**
+ * Only strings of these lengths can be similar to anything.
+ */
+static bool check_length(std::size_t len) noexcept {
+    return len >= MIN_STRLEN && len < MAX_STRLEN;
+}
+
+/**
+ * Maps hashes to ids. All entries are kept in one vector sorted by hash. A
+ * directory indexed by the top bits of the hash points to the first entry
+ * with those bits, so a lookup usually only has to look at one or two
+ * entries. The hashes must be well mixed for this to work.
+ */
+class hash_index {
+
+    using entry_type = std::pair<std::size_t, uint32_t>;
+
+    std::vector<entry_type> m_entries;
+    std::vector<std::size_t> m_directory;
+    unsigned int m_shift = 64;
+
+public:
+
+    using const_iterator = std::vector<entry_type>::const_iterator;
+
+    bool empty() const noexcept {
+        return m_entries.empty();
+    }
+
+    void add(std::size_t hash, uint32_t id) {
+        m_entries.emplace_back(hash, id);
+    }
+
+    /**
+     * Must be called after all entries were added and before any lookups.
+     */
+    void build() {
+        std::sort(m_entries.begin(), m_entries.end());
+
+        unsigned int bits = 1;
+        while ((1ULL << bits) < m_entries.size() && bits < 32) {
+            ++bits;
+        }
+        m_shift = 64 - bits;
+
+        m_directory.assign((1ULL << bits) + 1, m_entries.size());
+        for (std::size_t i = m_entries.size(); i > 0; --i) {
+            m_directory[m_entries[i - 1].first >> m_shift] = i - 1;
+        }
+        for (std::size_t i = m_directory.size() - 1; i > 0; --i) {
+            m_directory[i - 1] = std::min(m_directory[i - 1], m_directory[i]);
+        }
+    }
+
+    std::pair<const_iterator, const_iterator> find(std::size_t hash) const {
+        if (m_entries.empty()) {
+            return {m_entries.cend(), m_entries.cend()};
+        }
+
+        const auto bucket = hash >> m_shift;
+        auto it = m_entries.cbegin() + static_cast<std::ptrdiff_t>(m_directory[bucket]);
+        const auto end = m_entries.cbegin() + static_cast<std::ptrdiff_t>(m_directory[bucket + 1]);
+        while (it != end && it->first < hash) {
+            ++it;
+        }
+        auto last = it;
+        while (last != end && last->first == hash) {
+            ++last;
+        }
+        return {it, last};
+    }
+
+}; // class hash_index
+
+/**
+ * Index used to find candidates for similar strings without comparing all
+ * strings with each other. Candidates are not necessarily similar, they
+ * still have to be checked with similarity(), but all similar pairs are
+ * among the candidates.
+ *
+ * For the Levenshtein check we use the "deletion neighbourhood" of each
+ * string: Two strings with an edit distance of at most MAX_EDIT_DISTANCE
+ * will always have a common variant with up to MAX_EDIT_DISTANCE characters
+ * removed from each of them. Only hashes of those variants are stored.
+ * There is a separate index for each string length, so that lookups only
+ * need to look at the lengths that similarity() will check.
+ *
+ * For the substring check we keep an index of all (case-folded) 4-grams.
+ * If a string is a substring of another, all its 4-grams must appear in
+ * the other string, so it is enough to look at the strings containing the
+ * rarest 4-gram of the shorter string.
+ */
+class candidate_index {
+
+    static constexpr const std::size_t qgram_size = 4;
+
+    static_assert(MIN_STRLEN >= qgram_size, "All strings must have at least one q-gram");
+    static_assert(MAX_EDIT_DISTANCE == 2, "Deletion variants only implemented for up to two deletions");
+
+    const string_list& m_strings;
+
+    // Hashes of the deletion variants and the id of the string they came
+    // from, indexed by the length of the string.
+    std::vector<hash_index> m_variants;
+
+    // Case-folded q-grams and the id of the string they appear in
+    std::vector<std::pair<uint32_t, uint32_t>> m_qgrams;
+
+    /**
+     * Hash of the string with the characters at positions skip1 and skip2
+     * removed. This is the djb2 hash of the shortened string with the
+     * MurmurHash3 finalizer added, so that the top bits are usable for the
+     * hash_index.
+     */
+    static std::size_t variant_hash(const char* str, std::size_t len, std::size_t skip1, std::size_t skip2) noexcept {
+        uint64_t hash = 5381U;
+        for (std::size_t i = 0; i < len; ++i) {
+            if (i != skip1 && i != skip2) {
+                hash = ((hash << 5U) + hash) + static_cast<unsigned char>(str[i]);
+            }
+        }
+        hash ^= hash >> 33U;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33U;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33U;
+        return hash;
+    }
+
+    static void deletion_variants(const char* str, std::size_t len, std::vector<std::size_t>& hashes) {
+        hashes.clear();
+        hashes.push_back(variant_hash(str, len, len, len));
+        for (std::size_t i = 0; i < len; ++i) {
+            hashes.push_back(variant_hash(str, len, i, len));
+            for (std::size_t j = i + 1; j < len; ++j) {
+                hashes.push_back(variant_hash(str, len, i, j));
+            }
+        }
+
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    }
+
+    static void qgrams(const char* folded, std::size_t len, std::vector<uint32_t>& grams) {
+        grams.clear();
+        for (std::size_t i = 0; i + qgram_size <= len; ++i) {
+            uint32_t gram = 0;
+            for (std::size_t j = 0; j < qgram_size; ++j) {
+                gram = (gram << 8U) | static_cast<unsigned char>(folded[i + j]);
+            }
+            grams.push_back(gram);
+        }
+
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    }
+
+    template <typename TIterator, typename TKey>
+    static std::pair<TIterator, TIterator> lookup(TIterator begin, TIterator end, TKey key) {
+        using value_type = typename std::iterator_traits<TIterator>::value_type;
+        return std::equal_range(begin, end, value_type{key, 0},
+                                [](const value_type& a, const value_type& b) {
+            return a.first < b.first;
+        });
+    }
+
+public:
+
+    explicit candidate_index(const string_list& strings) :
+        m_strings(strings),
+        m_variants(MAX_STRLEN) {
+        std::vector<std::size_t> hashes;
+        std::vector<uint32_t> grams;
+
+        for (std::size_t len = MIN_STRLEN; len < MAX_STRLEN; ++len) {
+            auto& variants = m_variants[len];
+            for (const auto id : m_strings.with_length(len)) {
+                deletion_variants(m_strings.get(id), len, hashes);
+                for (const auto h : hashes) {
+                    variants.add(h, id);
+                }
+
+                qgrams(m_strings.folded(id), len, grams);
+                for (const auto g : grams) {
+                    m_qgrams.emplace_back(g, id);
+                }
+            }
+            variants.build();
+        }
+
+        std::sort(m_qgrams.begin(), m_qgrams.end());
+    }
+
+    /**
+     * Add all candidate pairs (smaller id first) with the string with the
+     * given id as one member to the pairs vector.
+     */
+    void candidates(uint32_t id, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const {
+        const auto len = m_strings.length(id);
+        if (!check_length(len)) {
+            return;
+        }
+
+        // Candidates for the Levenshtein check. Only strings with a length
+        // difference of less than MAX_EDIT_DISTANCE are checked. Because
+        // all variants of both strings are in the index, it is enough to
+        // find each pair from the side of the shorter string.
+        std::vector<std::size_t> hashes;
+        deletion_variants(m_strings.get(id), len, hashes);
+        const auto max_len = std::min<std::size_t>(len + (MAX_EDIT_DISTANCE - 1), MAX_STRLEN - 1);
+        for (auto other_len = len; other_len <= max_len; ++other_len) {
+            const auto& variants = m_variants[other_len];
+            if (variants.empty()) {
+                continue;
+            }
+            for (const auto h : hashes) {
+                const auto range = variants.find(h);
+                for (auto it = range.first; it != range.second; ++it) {
+                    const auto other = it->second;
+                    if (other_len > len) {
+                        pairs.emplace_back(std::min(id, other), std::max(id, other));
+                    } else if (other > id) {
+                        pairs.emplace_back(id, other);
+                    }
+                }
+            }
+        }
+
+        // Candidates for this string being a substring of another.
+        std::vector<uint32_t> grams;
+        qgrams(m_strings.folded(id), len, grams);
+        auto rarest = lookup(m_qgrams.cbegin(), m_qgrams.cend(), grams.front());
+        for (const auto g : grams) {
+            const auto range = lookup(m_qgrams.cbegin(), m_qgrams.cend(), g);
+            if (std::distance(range.first, range.second) < std::distance(rarest.first, rarest.second)) {
+                rarest = range;
+            }
+        }
+        for (auto it = rarest.first; it != rarest.second; ++it) {
+            const auto other = it->second;
+            if (other != id && m_strings.length(other) >= len) {
+                pairs.emplace_back(std::min(id, other), std::max(id, other));
+            }
+        }
+    }
+
+}; // class candidate_index
+
+std::vector<similarity_result> find_similarities(const string_list& strings, unsigned int num_threads) {
+    constexpr const std::size_t chunk_size = 1024;
+
+    const candidate_index index{strings};
+
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> thread_pairs(strings.size() / chunk_size + 1);
+    run_in_chunks(strings.size(), chunk_size, num_threads, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        for (auto id = static_cast<uint32_t>(begin); id < end; ++id) {
+            index.candidates(id, thread_pairs[chunk]);
+        }
+    });
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    for (auto& p : thread_pairs) {
+        pairs.insert(pairs.end(), p.begin(), p.end());
+        p.clear();
+        p.shrink_to_fit();
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    std::vector<std::vector<similarity_result>> chunk_results(pairs.size() / chunk_size + 1);
+    run_in_chunks(pairs.size(), chunk_size, num_threads, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const auto id1 = pairs[i].first;
+            const auto id2 = pairs[i].second;
+            const char* str1 = strings.get(id1);
+            const char* str2 = strings.get(id2);
+            const int sim = similarity(str1, strings.folded(id1), strings.length(id1),
+                                       str2, strings.folded(id2), strings.length(id2));
+            if (sim >= 0) {
+                chunk_results[chunk].push_back(similarity_result{pairs[i].first, pairs[i].second, sim});
+            }
+        }
+    });
+
+    std::vector<similarity_result> results;
+    for (const auto& r : chunk_results) {
+        results.insert(results.end(), r.begin(), r.end());
+    }
+
+    return results;
+}
+
+void write_similar_keys(Sqlite::Database& db, const string_list& keys, unsigned int num_threads) {
+    Sqlite::Statement insert{db, "INSERT INTO similar_keys (key1, key2, similarity) VALUES (?, ?, ?)"};
+    for (const auto& result : find_similarities(keys, num_threads)) {
+        insert.bind_text(keys.get(result.id1))
+              .bind_text(keys.get(result.id2))
+              .bind_int(result.similarity)
+              .execute();
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <sqlite.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+constexpr const int MIN_STRLEN = 4;
+constexpr const int MAX_STRLEN = 120;
+constexpr const int MAX_EDIT_DISTANCE = 2;
+
+/**
+ * ASCII-only version of tolower(). This is what strcasestr() does in the C
+ * locale we are running in.
+ */
+inline char fold_case(char c) noexcept {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/**
+ * A list of null-terminated strings stored back to back in one buffer. A
+ * second buffer contains case-folded copies of the strings at the same
+ * offsets. Lengths of all strings are precomputed and the ids of the
+ * strings are also available grouped by their length.
+ */
+class string_list {
+
+    std::string m_data;
+    std::string m_folded;
+    std::vector<std::size_t> m_offsets;
+    std::vector<uint32_t> m_lengths;
+
+    // Ids of all strings with length n in m_by_length[n], in order. Only
+    // strings up to MAX_STRLEN are in here.
+    std::vector<std::vector<uint32_t>> m_by_length;
+
+public:
+
+    string_list() :
+        m_by_length(MAX_STRLEN + 1) {
+    }
+
+    void add(const char* str) {
+        const auto len = std::strlen(str);
+        if (len <= MAX_STRLEN) {
+            m_by_length[len].push_back(static_cast<uint32_t>(m_offsets.size()));
+        }
+
+        m_offsets.push_back(m_data.size());
+        m_lengths.push_back(static_cast<uint32_t>(len));
+        for (; *str; ++str) {
+            m_data += *str;
+            m_folded += fold_case(*str);
+        }
+        m_data += '\0';
+        m_folded += '\0';
+    }
+
+    std::size_t size() const noexcept {
+        return m_offsets.size();
+    }
+
+    const char* get(std::size_t id) const noexcept {
+        return m_data.data() + m_offsets[id];
+    }
+
+    const char* folded(std::size_t id) const noexcept {
+        return m_folded.data() + m_offsets[id];
+    }
+
+    std::size_t length(std::size_t id) const noexcept {
+        return m_lengths[id];
+    }
+
+    const std::vector<uint32_t>& with_length(std::size_t len) const noexcept {
+        return m_by_length[len];
+    }
+
+}; // class string_list
+
+/**
+ * Two similar strings in a string_list. Similarity is 0 if one string
+ * contains the other, otherwise it is the edit distance.
+ */
+struct similarity_result {
+    uint32_t id1;
+    uint32_t id2;
+    int similarity;
+};
+
+/**
+ * Find similar strings in the list of strings using the specified number of
+ * threads. Results are returned in the order of the strings in the list.
+ */
+std::vector<similarity_result> find_similarities(const string_list& strings, unsigned int num_threads);
+
+/**
+ * Find similar keys in the list and write them into the similar_keys table.
+ * The keys should be sorted.
+ */
+void write_similar_keys(Sqlite::Database& db, const string_list& keys, unsigned int num_threads);
@@ -26,8 +26,10 @@
 #include <osmium/handler.hpp>
 #include <osmium/osm.hpp>
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring>
 
 /**
  * Osmium handler that collects basic statistics from OSM data and
@@ -37,9 +39,15 @@ class StatisticsHandler : public osmium::handler::Handler {
 
 public:
 
-    explicit StatisticsHandler(Sqlite::Database& database) :
+    /**
+     * If with_metadata is false, statistics derived from the metadata
+     * (see metadata_stat_names()) are not written to the database.
+     * Use this if the data was read without metadata.
+     */
+    explicit StatisticsHandler(Sqlite::Database& database, bool with_metadata = true) :
         Handler(),
-        m_database(database) {
+        m_database(database),
+        m_with_metadata(with_metadata) {
     }
 
     void node(const osmium::Node& node) noexcept {
@@ -148,36 +156,14 @@ public:
 
     static constexpr const std::size_t num_stats = 36;
 
-    void write_to_database() {
-        // if you change anything in this array, also change the corresponding struct below
-        static constexpr const std::array<const char*, num_stats> stat_names = {
-            "nodes",
-            "nodes_without_tags",
-            "node_tags",
-            "max_node_id",
-            "max_tags_on_node",
-            "ways",
-            "ways_without_tags",
-            "way_tags",
-            "way_nodes",
-            "way_nodes_consecutive",
-            "way_nodes_within_127",
-            "way_nodes_within_32767",
-            "max_way_id",
-            "max_tags_on_way",
-            "max_nodes_on_way",
-            "closed_ways",
-            "relations",
-            "relations_without_tags",
-            "relations_without_type",
-            "relation_tags",
-            "relation_members",
-            "relation_member_nodes",
-            "relation_member_ways",
-            "relation_member_relations",
-            "max_relation_id",
-            "max_tags_on_relation",
-            "max_members_on_relation",
+    static constexpr const std::size_t num_metadata_stats = 9;
+
+    /**
+     * Names of the statistics derived from the metadata. They are not
+     * written to the database if the handler was created without metadata.
+     */
+    static const std::array<const char*, num_metadata_stats>& metadata_stat_names() noexcept {
+        static constexpr const std::array<const char*, num_metadata_stats> names = {
             "max_user_id",
             "anon_user_objects",
             "max_node_version",
@@ -188,13 +174,39 @@ public:
             "sum_relation_version",
             "max_changeset_id"
         };
+        return names;
+    }
 
+    /**
+     * Add the statistics collected by another handler to the ones in this
+     * handler. Statistics with names starting with "max_" are maxima, all
+     * others are sums.
+     */
+    void merge(const StatisticsHandler& other) noexcept {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        auto* stats = reinterpret_cast<uint64_t*>(&m_stats);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        const auto* other_stats = reinterpret_cast<const uint64_t*>(&other.m_stats);
+
+        for (std::size_t i = 0; i < num_stats; ++i) {
+            if (std::strncmp(stat_names()[i], "max_", 4) == 0) {
+                stats[i] = std::max(stats[i], other_stats[i]);
+            } else {
+                stats[i] += other_stats[i];
+            }
+        }
+    }
+
+    void write_to_database() {
         Sqlite::Statement statement_insert_into_main_stats{m_database, "INSERT INTO stats (key, value) VALUES (?, ?);"};
         m_database.begin_transaction();
 
-        for (std::size_t i = 0; i < stat_names.size(); ++i) {
+        for (std::size_t i = 0; i < num_stats; ++i) {
+            if (!m_with_metadata && is_metadata_stat(stat_names()[i])) {
+                continue;
+            }
             statement_insert_into_main_stats
-                .bind_text(stat_names[i])
+                .bind_text(stat_names()[i])
                 // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
                 .bind_int64(static_cast<int64_t>(reinterpret_cast<uint64_t*>(&m_stats)[i]))
                 .execute();
@@ -209,7 +221,7 @@ public:
 
 private:
 
-    // if you change anything in this struct, also change the corresponding array above
+    // if you change anything in this struct, also change the corresponding array below
     struct statistics {
         uint64_t nodes = 0;
         uint64_t nodes_without_tags = 0;
@@ -252,8 +264,60 @@ private:
     static_assert(sizeof(statistics) == sizeof(uint64_t) * num_stats,
                   "Size mismatch between struct statistics and stat_names array");
 
+    static const std::array<const char*, num_stats>& stat_names() noexcept {
+        // if you change anything in this array, also change the corresponding struct above
+        static constexpr const std::array<const char*, num_stats> names = {
+            "nodes",
+            "nodes_without_tags",
+            "node_tags",
+            "max_node_id",
+            "max_tags_on_node",
+            "ways",
+            "ways_without_tags",
+            "way_tags",
+            "way_nodes",
+            "way_nodes_consecutive",
+            "way_nodes_within_127",
+            "way_nodes_within_32767",
+            "max_way_id",
+            "max_tags_on_way",
+            "max_nodes_on_way",
+            "closed_ways",
+            "relations",
+            "relations_without_tags",
+            "relations_without_type",
+            "relation_tags",
+            "relation_members",
+            "relation_member_nodes",
+            "relation_member_ways",
+            "relation_member_relations",
+            "max_relation_id",
+            "max_tags_on_relation",
+            "max_members_on_relation",
+            "max_user_id",
+            "anon_user_objects",
+            "max_node_version",
+            "max_way_version",
+            "max_relation_version",
+            "sum_node_version",
+            "sum_way_version",
+            "sum_relation_version",
+            "max_changeset_id"
+        };
+        return names;
+    }
+
+    static bool is_metadata_stat(const char* name) noexcept {
+        const auto& names = metadata_stat_names();
+        return std::any_of(names.cbegin(), names.cend(), [name](const char* metadata_name) {
+            return std::strcmp(name, metadata_name) == 0;
+        });
+    }
+
     Sqlite::Database& m_database;
 
+    bool m_with_metadata;
+
     osmium::unsigned_object_id_type m_id = 0;
     std::size_t m_tag_count = 0;
     osmium::object_version_type m_version = 0;
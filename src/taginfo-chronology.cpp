@@ -19,6 +19,7 @@
 
 */
 
+#include "hyperloglog.hpp"
 #include "util.hpp"
 #include "version.hpp"
 
@@ -37,9 +38,13 @@
 
 #include <getopt.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -47,20 +52,123 @@
 static constexpr const std::size_t seconds_in_a_day = 60UL * 60UL * 24UL;
 
 // Due to database format changes on that date, the OSM history data dump
-// does not contain object versions before 2007-10-07. So we simply start
-// our statistics on that date. This is the offset from 1970-01-01.
+// does not contain object versions before 2007-10-07. So by default we
+// start our statistics on that date. This is the offset from 1970-01-01.
 static constexpr const std::size_t offset_days = 13793;
 
-// Number of days we store from today back to 2007-10-07
-static std::size_t const count = (std::time(nullptr) / seconds_in_a_day) + 1 - offset_days;
+// Keep at most this many distinct value sketches per key. If there are more
+// time buckets than this, neighbouring buckets share a sketch.
+static constexpr const std::size_t max_distinct_value_sketches = 256;
+
+enum class granularity {
+    day,
+    week,
+    month
+};
+
+static granularity get_granularity(const char* str) {
+    if (!std::strcmp(str, "day")) {
+        return granularity::day;
+    }
+    if (!std::strcmp(str, "week")) {
+        return granularity::week;
+    }
+    if (!std::strcmp(str, "month")) {
+        return granularity::month;
+    }
+    throw std::range_error{"invalid granularity"};
+}
+
+/**
+ * Maps days (counted from 1970-01-01) to the time buckets we keep counters
+ * for. Everything before the start day ends up in the first bucket.
+ */
+class time_buckets {
+
+    granularity m_granularity;
+    std::size_t m_start_day;
+    std::size_t m_count;
+
+    static int64_t month_number(std::size_t day) noexcept {
+        const auto date = civil_from_days(static_cast<int64_t>(day));
+        return date.year * 12 + date.month - 1;
+    }
+
+public:
+
+    time_buckets(granularity gran, std::size_t start_day, std::size_t end_day) :
+        m_granularity(gran),
+        m_start_day(start_day) {
+        if (gran == granularity::month) {
+            // monthly buckets always start on the first of the month
+            auto date = civil_from_days(static_cast<int64_t>(start_day));
+            date.day = 1;
+            m_start_day = static_cast<std::size_t>(days_from_civil(date));
+        }
+        m_count = index(end_day) + 1;
+    }
+
+    std::size_t count() const noexcept {
+        return m_count;
+    }
+
+    std::size_t index(std::size_t day) const noexcept {
+        if (day <= m_start_day) {
+            return 0;
+        }
+
+        switch (m_granularity) {
+            case granularity::week:
+                return (day - m_start_day) / 7;
+            case granularity::month:
+                return static_cast<std::size_t>(month_number(day) - month_number(m_start_day));
+            case granularity::day:
+                break;
+        }
+
+        return day - m_start_day;
+    }
+
+    std::size_t first_day(std::size_t idx) const noexcept {
+        switch (m_granularity) {
+            case granularity::week:
+                return m_start_day + idx * 7;
+            case granularity::month: {
+                const auto month = month_number(m_start_day) + static_cast<int64_t>(idx);
+                const civil_date date{month / 12, static_cast<unsigned int>(month % 12) + 1, 1};
+                return static_cast<std::size_t>(days_from_civil(date));
+            }
+            case granularity::day:
+                break;
+        }
+
+        return m_start_day + idx;
+    }
+
+}; // class time_buckets
+
+/**
+ * Are the tags on both objects the same (including their order)?
+ */
+static bool same_tags(const osmium::OSMObject& a, const osmium::OSMObject& b) noexcept {
+    const auto& atags = a.tags();
+    const auto& btags = b.tags();
+    return atags.byte_size() == btags.byte_size() &&
+           std::equal(atags.cbegin(), atags.cend(), btags.cbegin(), btags.cend());
+}
 
 static void print_help() {
     std::cout << "taginfo-chronology [OPTIONS] OSMFILE DATABASE\n\n" \
               << "This program is part of taginfo. It calculates statistics on OSM tags\n" \
               << "from the OSM history file OSMFILE and puts them into DATABASE (an SQLite database).\n" \
               << "\nOptions:\n" \
+              << "  -d, --distinct-values         Also record number of distinct values per key\n" \
+              << "                                (at most " << max_distinct_value_sketches << " points in time per key,\n" \
+              << "                                up to " << max_distinct_value_sketches << " kBytes per key)\n" \
+              << "  -g, --granularity=GRANULARITY Time granularity: day (default), week, or month\n" \
               << "  -H, --help                    Print this help message and exit\n" \
-              << "  -s, --selection-db=DATABASE   Name of selection database\n";
+              << "  -s, --selection-db=DATABASE   Name of selection database\n" \
+              << "  -S, --start-date=DATE         Start date of statistics (default: 2007-10-07)\n";
 }
 
 class chronology_store {
@@ -86,6 +194,28 @@ class chronology_store {
         return nodes(n) != 0 || ways(n) != 0 || relations(n) != 0;
     }
 
+    /**
+     * Encode the counters for all buckets with changes into out. Each
+     * bucket is written as its first day and the node, way, and relation
+     * counters. Returns the first day with any change.
+     */
+    int encode(const time_buckets& buckets, std::vector<int32_t>& out) const {
+        int first_use = 0;
+        for (std::size_t i = 0; i < buckets.count(); ++i) {
+            if (any(i)) {
+                const auto day = static_cast<int32_t>(buckets.first_day(i));
+                if (first_use == 0) {
+                    first_use = day;
+                }
+                out.push_back(day);
+                out.push_back(nodes(i));
+                out.push_back(ways(i));
+                out.push_back(relations(i));
+            }
+        }
+        return first_use;
+    }
+
 public:
 
     std::size_t bytes_used() const noexcept {
@@ -94,35 +224,17 @@ public:
                sizeof(int32_t) * m_changes(osmium::item_type::relation).size();
     }
 
-    void update(osmium::item_type type, std::size_t day, int32_t change) {
+    void update(const time_buckets& buckets, osmium::item_type type, std::size_t idx, int32_t change) {
         auto& v = m_changes(type);
         if (v.empty()) {
-            v.resize(count);
-        }
-
-        if (day <= offset_days) {
-            v[0] += change;
-        } else {
-            const auto idx = day - offset_days;
-            v[idx] += change;
+            v.resize(buckets.count());
         }
+        v[idx] += change;
     }
 
-    void write(Sqlite::Statement& stmt, const std::string& key) const {
+    void write(Sqlite::Statement& stmt, const time_buckets& buckets, const std::string& key) const {
         std::vector<int32_t> out;
-
-        int first_use = 0;
-        for (std::size_t i = 0; i < count; ++i) {
-            if (any(i)) {
-                if (first_use == 0) {
-                    first_use = i + offset_days;
-                }
-                out.push_back(static_cast<int32_t>(i + offset_days));
-                out.push_back(nodes(i));
-                out.push_back(ways(i));
-                out.push_back(relations(i));
-            }
-        }
+        const auto first_use = encode(buckets, out);
 
         stmt.bind_text(key)
             .bind_blob(out.data(), static_cast<int>(out.size() * sizeof(int32_t)))
@@ -130,21 +242,9 @@ public:
             .execute();
     }
 
-    void write(Sqlite::Statement& stmt, const std::pair<std::string, std::string>& tag) const {
+    void write(Sqlite::Statement& stmt, const time_buckets& buckets, const std::pair<std::string, std::string>& tag) const {
         std::vector<int32_t> out;
-
-        int first_use = 0;
-        for (std::size_t i = 0; i < count; ++i) {
-            if (any(i)) {
-                if (first_use == 0) {
-                    first_use = i + offset_days;
-                }
-                out.push_back(static_cast<int32_t>(i + offset_days));
-                out.push_back(nodes(i));
-                out.push_back(ways(i));
-                out.push_back(relations(i));
-            }
-        }
+        const auto first_use = encode(buckets, out);
 
         stmt.bind_text(tag.first)
             .bind_text(tag.second)
@@ -155,11 +255,68 @@ public:
 
 }; // class chronology_store
 
+/**
+ * Keeps a sketch of the distinct values used with a key in each group of
+ * time buckets. When written out, the sketches are merged in time order so
+ * we get the number of distinct values the key has had up to each group.
+ */
+class distinct_values_store {
+
+    absl::flat_hash_map<std::size_t, HyperLogLog> m_sketches;
+
+public:
+
+    std::size_t bytes_used() const noexcept {
+        std::size_t bytes = 0;
+        for (const auto& sketch : m_sketches) {
+            bytes += sizeof(sketch) + sketch.second.bytes_used();
+        }
+        return bytes;
+    }
+
+    void add(std::size_t idx, const char* value) {
+        m_sketches[idx].add(value);
+    }
+
+    void write(Sqlite::Statement& stmt, const time_buckets& buckets, std::size_t step, const std::string& key) const {
+        std::vector<std::pair<std::size_t, const HyperLogLog*>> sketches;
+        sketches.reserve(m_sketches.size());
+        for (const auto& sketch : m_sketches) {
+            sketches.emplace_back(sketch.first, &sketch.second);
+        }
+        std::sort(sketches.begin(), sketches.end());
+
+        std::vector<int32_t> out;
+        HyperLogLog all;
+        uint64_t last_estimate = 0;
+        for (const auto& sketch : sketches) {
+            all.merge(*sketch.second);
+            const auto estimate = all.estimate();
+            if (estimate != last_estimate) {
+                out.push_back(static_cast<int32_t>(buckets.first_day(sketch.first * step)));
+                out.push_back(static_cast<int32_t>(estimate));
+                last_estimate = estimate;
+            }
+        }
+
+        stmt.bind_text(key)
+            .bind_blob(out.data(), static_cast<int>(out.size() * sizeof(int32_t)))
+            .execute();
+    }
+
+}; // class distinct_values_store
+
 class Handler : osmium::diff_handler::DiffHandler {
 
     osmium::util::VerboseOutput& m_vout;
+    time_buckets m_buckets;
     absl::flat_hash_map<std::string, chronology_store> m_keys;
     absl::flat_hash_map<std::pair<std::string, std::string>, chronology_store> m_tags;
+    absl::flat_hash_map<std::string, distinct_values_store> m_key_values;
+    bool m_distinct_values;
+
+    // Number of time buckets sharing one distinct value sketch
+    std::size_t m_values_step;
 
     osmium::Timestamp m_max_timestamp{};
     std::size_t m_count_nodes = 0;
@@ -169,6 +326,9 @@ class Handler : osmium::diff_handler::DiffHandler {
     std::size_t m_count_visible_ways = 0;
     std::size_t m_count_visible_relations = 0;
 
+    // Stores touched by the current object version, reused between calls
+    std::vector<chronology_store*> m_stores;
+
     void object(const osmium::DiffObject& object) {
         if (m_max_timestamp < object.curr().timestamp()) {
             m_max_timestamp = object.curr().timestamp();
@@ -178,38 +338,68 @@ class Handler : osmium::diff_handler::DiffHandler {
             return;
         }
 
-        const auto sday = object.start_time().seconds_since_epoch() / seconds_in_a_day;
-        const auto eday = object.end_time().seconds_since_epoch() / seconds_in_a_day;
+        // Each version counts +1 on its start day and -1 on its end day. If
+        // the neighbouring version of the same object has the same tags,
+        // the -1 of one version and the +1 of the next are on the same day
+        // and cancel out, so we don't have to do either.
+        const bool add = object.first() || object.prev().deleted() ||
+                         !same_tags(object.prev(), object.curr());
+        const bool remove = !object.last() && (object.next().deleted() ||
+                            !same_tags(object.curr(), object.next()));
 
-        if (sday == eday) {
+        if (!add && !remove) {
             return;
         }
 
-        const auto type = object.type();
+        const auto sidx = m_buckets.index(object.start_time().seconds_since_epoch() / seconds_in_a_day);
+        const auto eidx = m_buckets.index(object.end_time().seconds_since_epoch() / seconds_in_a_day);
 
-        for (const auto& tag: object.curr().tags()) {
-            auto& store = m_keys[tag.key()];
-            store.update(type, sday, 1);
-            if (!object.last()) {
-                store.update(type, eday, -1);
+        // Values are recorded even if this version doesn't change the
+        // counts, because the value might be new for the key.
+        if (add && m_distinct_values) {
+            for (const auto& tag: object.curr().tags()) {
+                m_key_values[tag.key()].add(sidx / m_values_step, tag.value());
             }
+        }
+
+        if (add && remove && sidx == eidx) {
+            return;
+        }
+
+        // Make sure inserting new keys doesn't rehash the map while we are
+        // holding pointers to its values.
+        m_keys.reserve(m_keys.size() + object.curr().tags().size());
+
+        m_stores.clear();
+        for (const auto& tag: object.curr().tags()) {
+            m_stores.push_back(&m_keys[tag.key()]);
 
             if (!m_tags.empty()) {
                 auto it = m_tags.find(std::pair<std::string, std::string>{tag.key(), tag.value()});
                 if (it != m_tags.end()) {
-                    it->second.update(type, sday, 1);
-                    if (!object.last()) {
-                        it->second.update(type, eday, -1);
-                    }
+                    m_stores.push_back(&it->second);
                 }
             }
         }
+
+        const auto type = object.type();
+        for (auto* store : m_stores) {
+            if (add) {
+                store->update(m_buckets, type, sidx, 1);
+            }
+            if (remove) {
+                store->update(m_buckets, type, eidx, -1);
+            }
+        }
     }
 
 public:
 
-    Handler(osmium::util::VerboseOutput& vout, const std::string &selection_database_name) :
-        m_vout(vout) {
+    Handler(osmium::util::VerboseOutput& vout, const time_buckets& buckets, const std::string &selection_database_name, bool distinct_values) :
+        m_vout(vout),
+        m_buckets(buckets),
+        m_distinct_values(distinct_values),
+        m_values_step((buckets.count() + max_distinct_value_sketches - 1) / max_distinct_value_sketches) {
         if (!selection_database_name.empty()) {
             m_vout << "Opening selection database: " << selection_database_name << '\n';
             Sqlite::Database sdb{selection_database_name, SQLITE_OPEN_READONLY};
@@ -272,7 +462,7 @@ public:
 
             for (const auto& hist : m_keys) {
                 bytes_keys += hist.second.bytes_used();
-                hist.second.write(statement_insert, hist.first);
+                hist.second.write(statement_insert, m_buckets, hist.first);
             }
 
             m_vout << "Key counters needed " << (bytes_keys / (1024UL * 1024UL)) << " MBytes\n";
@@ -285,38 +475,69 @@ public:
 
             for (const auto& hist : m_tags) {
                 bytes_tags += hist.second.bytes_used();
-                hist.second.write(statement_insert, hist.first);
+                hist.second.write(statement_insert, m_buckets, hist.first);
             }
         }
 
         m_vout << "Tag counters needed " << (bytes_tags / (1024UL * 1024UL)) << " MBytes\n";
+
+        if (m_distinct_values) {
+            std::size_t bytes_values = 0;
+
+            Sqlite::Statement statement_insert{db,
+                "INSERT INTO keys_distinct_values_chronology (key, data) VALUES (?, ?);"};
+
+            for (const auto& hist : m_key_values) {
+                bytes_values += hist.second.bytes_used();
+                hist.second.write(statement_insert, m_buckets, m_values_step, hist.first);
+            }
+
+            m_vout << "Distinct value sketches needed " << (bytes_values / (1024UL * 1024UL)) << " MBytes\n";
+        }
     }
 
 }; // class Handler
 
 int main(int argc, char* argv[]) {
     static const option long_options[] = {
-        {"help",         no_argument,       nullptr, 'H'},
-        {"selection-db", required_argument, nullptr, 's'},
+        {"distinct-values", no_argument,       nullptr, 'd'},
+        {"granularity",     required_argument, nullptr, 'g'},
+        {"help",            no_argument,       nullptr, 'H'},
+        {"selection-db",    required_argument, nullptr, 's'},
+        {"start-date",      required_argument, nullptr, 'S'},
         {nullptr, 0, nullptr, 0}
     };
 
     std::string selection_database_name;
 
+    granularity gran = granularity::day;
+    std::size_t start_day = offset_days;
+
+    bool distinct_values = false;
+
     while (true) {
         // NOLINTNEXTLINE(concurrency-mt-unsafe)
-        const int c = getopt_long(argc, argv, "Hs:", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "dg:Hs:S:", long_options, nullptr);
         if (c == -1) {
             break;
         }
 
         switch (c) {
+            case 'd':
+                distinct_values = true;
+                break;
+            case 'g':
+                gran = get_granularity(optarg);
+                break;
             case 'H':
                 print_help();
                 return 0;
             case 's':
                 selection_database_name = optarg;
                 break;
+            case 'S':
+                start_day = static_cast<std::size_t>(get_date(optarg));
+                break;
             default:
                 return 1;
         }
@@ -344,7 +565,12 @@ int main(int argc, char* argv[]) {
             return 2;
         }
 
-        Handler handler{vout, selection_database_name};
+        const std::size_t today = std::time(nullptr) / seconds_in_a_day;
+        const time_buckets buckets{gran, start_day, today};
+        vout << "Using " << buckets.count() << " time buckets starting on "
+             << time_string(osmium::Timestamp{buckets.first_day(0) * seconds_in_a_day}).substr(0, 10) << '\n';
+
+        Handler handler{vout, buckets, selection_database_name, distinct_values};
 
         vout << "Processing input file...\n";
         osmium::apply_diff(reader, handler);
@@ -19,121 +19,167 @@
 
 */
 
+#include "similarity.hpp"
+#include "util.hpp"
+
 #include <sqlite.hpp>
 
-#include <algorithm>
-#include <cstdlib>
-#include <cstring>
+#include <getopt.h>
+
+#include <exception>
 #include <iostream>
 #include <string>
+#include <vector>
 
-constexpr const int MIN_STRLEN = 4;
-constexpr const int MAX_STRLEN = 120;
-constexpr const int MAX_EDIT_DISTANCE = 2;
-
-/**
- * Compute Levenshtein edit distance. This is a very simple implementation of
- * the Levenshtein algorithm I copied from somewhere on the Internet, but it
- * is fast enough for our purpose here.
- */
-static int edit_distance(const char* str1, std::size_t len1, const char* str2, std::size_t len2) noexcept {
-    static int d[MAX_STRLEN][MAX_STRLEN];
+static void find_similar_keys(Sqlite::Database& db, unsigned int num_threads) {
+    string_list keys;
 
-    d[0][0] = 0;
-    for (std::size_t i = 1; i <= len1; ++i) {
-        d[i][0] = static_cast<int>(i);
-    }
-    for (std::size_t i = 1; i <= len2; ++i) {
-        d[0][i] = static_cast<int>(i);
+    Sqlite::Statement select{db, "SELECT key FROM keys ORDER BY key"};
+    while (select.read()) {
+        keys.add(select.get_text_ptr(0));
     }
 
-    for (std::size_t i = 1; i <= len1; ++i) {
-        for (std::size_t j = 1; j <= len2; ++j) {
-            d[i][j] = std::min(std::min(d[i - 1][j] + 1, d[i][j - 1] + 1),
-                               d[i - 1][j - 1] + (str1[i - 1] == str2[j - 1] ? 0 : 1));
-        }
-    }
-
-    return d[len1][len2];
+    db.begin_transaction();
+    write_similar_keys(db, keys, num_threads);
+    db.commit();
 }
 
 /**
- * Are the two given strings similar according to some metric?
+ * Find similar values for each of the num_keys keys with the highest count.
+ * The values are read from the tags table sorted by key, so only the values
+ * of one key and their index are in memory at any time. If max_values is
+ * not 0, keys with more than max_values values are skipped, because the
+ * index needs a lot of memory for each value.
  */
-static int similarity(const char* str1, std::size_t len1, const char* str2, std::size_t len2) noexcept {
-    // Do not check very short strings, because they create too many false
-    // positives.
-    if (len1 < MIN_STRLEN || len2 < MIN_STRLEN) {
-        return -1;
-    }
+static void find_similar_values(Sqlite::Database& db, unsigned int num_keys, unsigned int max_values, unsigned int num_threads) {
+    Sqlite::Statement select{db, "SELECT key, value, count_all FROM tags WHERE key IN (SELECT key FROM keys ORDER BY count_all DESC LIMIT ?) ORDER BY key, value"};
+    select.bind_int64(num_keys);
 
-    // Do not check very long strings. This keeps memory use and run time for
-    // Levenshtein algorithm in check.
-    if (len1 >= MAX_STRLEN || len2 >= MAX_STRLEN) {
-        return -1;
-    }
+    Sqlite::Statement insert{db, "INSERT INTO similar_values (key, value1, value2, count_all1, count_all2, similarity) VALUES (?, ?, ?, ?, ?, ?)"};
 
-    // Check if one string is a substring of the other. This will also check
-    // if both strings differ only in case.
-    if (strcasestr(str1, str2) || strcasestr(str2, str1)) {
-        return 0;
-    }
+    std::string key;
+    string_list values;
+    std::vector<int64_t> counts;
+    bool skip = false;
 
-    // Do not check strings if they have very different lengths, they can't
-    // be similar according to Levenshtein anyway.
-    if (std::abs(static_cast<int64_t>(len1) - static_cast<int64_t>(len2)) >= MAX_EDIT_DISTANCE) {
-        return -1;
+    const auto write_similar_values = [&]() {
+        if (skip) {
+            std::cerr << "Skipped key '" << key << "' with more than " << max_values << " values\n";
+            return;
+        }
+        for (const auto& result : find_similarities(values, num_threads)) {
+            insert.bind_text(key)
+                  .bind_text(values.get(result.id1))
+                  .bind_text(values.get(result.id2))
+                  .bind_int64(counts[result.id1])
+                  .bind_int64(counts[result.id2])
+                  .bind_int(result.similarity)
+                  .execute();
+        }
+    };
+
+    db.begin_transaction();
+    while (select.read()) {
+        const char* k = select.get_text_ptr(0);
+        if (key != k) {
+            if (!key.empty()) {
+                write_similar_values();
+            }
+            key = k;
+            values = string_list{};
+            counts.clear();
+            skip = false;
+        }
+        if (skip) {
+            continue;
+        }
+        if (max_values != 0 && values.size() == max_values) {
+            values = string_list{};
+            counts.clear();
+            skip = true;
+            continue;
+        }
+        values.add(select.get_text_ptr(1));
+        counts.push_back(select.get_int(2));
     }
-
-    // Check Levenshtein edit distance.
-    const int distance = edit_distance(str1, len1, str2, len2);
-    if (distance <= MAX_EDIT_DISTANCE) {
-        return distance;
+    if (!key.empty()) {
+        write_similar_values();
     }
+    db.commit();
+}
 
-    return -1;
+static void print_help() {
+    std::cout << "taginfo-similarity [OPTIONS] DATABASE\n\n" \
+              << "This program is part of taginfo. It finds similar keys in the keys table\n" \
+              << "of DATABASE (an SQLite database) and writes them into the similar_keys table.\n" \
+              << "With --values it finds similar values of the most used keys in the tags table\n" \
+              << "instead and writes them into the similar_values table.\n" \
+              << "\nOptions:\n" \
+              << "  -H, --help                    Print this help message and exit\n" \
+              << "  -m, --max-values=NUM          Skip keys with more than NUM values when finding\n" \
+              << "                                similar values (default: 0, no limit)\n" \
+              << "  -t, --threads=NUM             Number of threads to use (default: 1)\n" \
+              << "  -v, --values=NUM              Find similar values of the NUM most used keys\n" \
+              << "\nFinding similar values of a key needs about 8 * len * len bytes for each\n" \
+              << "value with len characters (up to 115 kB for the longest values checked),\n" \
+              << "so keys with many values (like name) can need a lot of memory. Use\n" \
+              << "--max-values to skip them, skipped keys are reported on stderr and have\n" \
+              << "no entries in the similar_values table.\n";
 }
 
-/**
- * Iterate over all (null-terminated) strings in the memory between begin and
- * end and find similar strings.
- */
-static void find_similarities(const char* begin, const char* end, Sqlite::Statement& insert) {
-    std::size_t len1 = 0;
-    for (const char* str1 = begin; str1 != end; str1 += len1 + 1) {
-        len1 = std::strlen(str1);
-        std::size_t len2 = 0;
-        for (const char* str2 = str1 + len1; str2 != end; str2 += len2 + 1) {
-            len2 = std::strlen(str2);
-            const int sim = similarity(str1, len1, str2, len2);
-            if (sim >= 0) {
-                //std::cout << "[" << str1 << "][" << str2 << "]\n";
-                insert.bind_text(str1).bind_text(str2).bind_int(sim).execute();
-            }
+int main(int argc, char *argv[]) {
+    static const option long_options[] = {
+        {"help",       no_argument,       nullptr, 'H'},
+        {"max-values", required_argument, nullptr, 'm'},
+        {"threads",    required_argument, nullptr, 't'},
+        {"values",     required_argument, nullptr, 'v'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    unsigned int num_threads = 1;
+    unsigned int num_value_keys = 0;
+    unsigned int max_values = 0;
+
+    while (true) {
+        // NOLINTNEXTLINE(concurrency-mt-unsafe)
+        const int c = getopt_long(argc, argv, "Hm:t:v:", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'H':
+                print_help();
+                return 0;
+            case 'm':
+                max_values = get_uint(optarg);
+                break;
+            case 't':
+                num_threads = get_uint(optarg);
+                if (num_threads == 0) {
+                    num_threads = 1;
+                }
+                break;
+            case 'v':
+                num_value_keys = get_uint(optarg);
+                break;
+            default:
+                return 1;
         }
     }
-}
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "taginfo-similarity DATABASE\n";
+    if (argc - optind != 1) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] DATABASE\n";
         return 1;
     }
 
     try {
-        std::string data;
-
-        Sqlite::Database db{argv[1], SQLITE_OPEN_READWRITE};
-        Sqlite::Statement select{db, "SELECT key FROM keys ORDER BY key"};
-        while (select.read()) {
-            data += select.get_text_ptr(0);
-            data += '\0';
+        Sqlite::Database db{argv[optind], SQLITE_OPEN_READWRITE};
+        if (num_value_keys > 0) {
+            find_similar_values(db, num_value_keys, max_values, num_threads);
+        } else {
+            find_similar_keys(db, num_threads);
         }
-
-        Sqlite::Statement insert{db, "INSERT INTO similar_keys (key1, key2, similarity) VALUES (?, ?, ?)"};
-        db.begin_transaction();
-        find_similarities(data.c_str(), data.c_str() + data.size(), insert);
-        db.commit();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << '\n';
         return 2;
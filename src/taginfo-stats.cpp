@@ -19,8 +19,12 @@
 
 */
 
+#include "count-min-sketch.hpp"
 #include "geodistribution.hpp"
+#include "regions-handler.hpp"
+#include "similarity.hpp"
 #include "tagstats-handler.hpp"
+#include "unicode.hpp"
 #include "util.hpp"
 #include "version.hpp"
 
@@ -28,6 +32,7 @@
 
 #include <osmium/diff_handler.hpp>
 #include <osmium/diff_visitor.hpp>
+#include <osmium/handler.hpp>
 #include <osmium/io/any_input.hpp>
 #include <osmium/io/file.hpp>
 #include <osmium/util/verbose_output.hpp>
@@ -35,7 +40,12 @@
 
 #include <getopt.h>
 
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 unsigned int GeoDistribution::c_width;
 unsigned int GeoDistribution::c_height;
@@ -46,27 +56,66 @@ static void print_help() {
               << "from OSMFILE and puts them into DATABASE (an SQLite database).\n" \
               << "\nOptions:\n" \
               << "  -H, --help                    Print this help message and exit\n" \
+              << "  -c, --cell-index=FILE         Read location cell index from FILE instead of\n" \
+              << "                                building it from the nodes\n" \
               << "  -i, --index=INDEX_TYPE        Set index type for location index (default: FlexMem)\n" \
               << "  -I, --show-index-types        Show available index types for location index\n" \
+              << "  -k, --min-key-combination-count=N  Key combinations not appearing this often\n" \
+              << "                                     are not written to database (default: 0,\n" \
+              << "                                     write all). If set, key combinations are\n" \
+              << "                                     pruned like tag combinations with -P.\n" \
+              << "  -o, --write-cell-index=FILE   Write location cell index to FILE\n" \
               << "  -m, --min-tag-combination-count=N  Tag combinations not appearing this often\n" \
               << "                                     are not written to database\n" \
+              << "  -P, --prune-tag-combinations  Only store tag combinations that probably\n" \
+              << "                                appear often enough to be written to the\n" \
+              << "                                database. Saves memory, but count_all can be\n" \
+              << "                                too high and objects seen before a combination\n" \
+              << "                                was stored are counted for one object type.\n" \
+              << "                                count_all can be too high by up to about\n" \
+              << "                                e * N / W for N combinations seen and W\n" \
+              << "                                counters per row of the sketch (see -z).\n" \
+              << "  -R, --regions=FILE            Also calculate statistics for the regions\n" \
+              << "                                listed in FILE\n" \
               << "  -s, --selection-db=DATABASE   Name of selection database\n" \
+              << "  -S, --similarity              Also find similar keys (like taginfo-similarity)\n" \
+              << "  -U, --unicode                 Also find unusual characters in keys\n" \
+              << "                                (like taginfo-unicode)\n" \
+              << "  -T, --threads=NUM             Number of threads for similarity and unicode\n" \
+              << "                                checks (default: 1)\n" \
               << "  -t, --top=NUMBER              Top of bounding box for distribution images\n" \
               << "  -r, --right=NUMBER            Right of bounding box for distribution images\n" \
               << "  -b, --bottom=NUMBER           Bottom of bounding box for distribution images\n" \
               << "  -l, --left=NUMBER             Left of bounding box for distribution images\n" \
               << "  -w, --width=NUMBER            Width of distribution images (default: 360)\n" \
               << "  -h, --height=NUMBER           Height of distribution images (default: 180)\n" \
-              << "\nDefault for bounding box is: (-180, -90, 180, 90).\n";
+              << "  -z, --sketch-size=MB          Size of each sketch used for counting key and\n" \
+              << "                                tag combinations with -k and -P (default: 256).\n" \
+              << "                                It has 4 rows with MB * 65536 counters each,\n" \
+              << "                                rounded up to a power of two. Use a bigger\n" \
+              << "                                sketch for bigger inputs. Each region (see -R)\n" \
+              << "                                has its own sketches of this size.\n" \
+              << "\nDefault for bounding box is: (-180, -90, 180, 90).\n" \
+              << "\nThe regions file contains one region per line with the name of its\n" \
+              << "database and its bounding box: DATABASE LEFT BOTTOM RIGHT TOP\n" \
+              << "All other options are the same for all regions. Each region has its own\n" \
+              << "location index containing only the nodes in the region. It is always a\n" \
+              << "sparse index (SparseMmapArray if the index type is DenseMmapArray or\n" \
+              << "SparseMmapArray, SparseMemArray otherwise) which needs about 16 bytes\n" \
+              << "per node in the region. With -k or -P each region also has its own\n" \
+              << "sketches (see -z), so their memory use grows with the number of regions.\n" \
+              << "The region databases must be prepared like the main database, this is\n" \
+              << "checked before the input file is read.\n";
 }
 
+template <typename THandler>
 class LastVersionHandler : public osmium::diff_handler::DiffHandler {
 
-    TagStatsHandler& m_handler;
+    THandler& m_handler;
 
 public:
 
-    explicit LastVersionHandler(TagStatsHandler& handler) noexcept :
+    explicit LastVersionHandler(THandler& handler) noexcept :
         m_handler(handler) {
     }
 
@@ -90,28 +139,155 @@ public:
 
 }; // LastVersionHandler
 
+/**
+ * Forwards only visible objects to the handler. Data files can contain
+ * deleted objects (for instance written by "osmium cat" from a change
+ * file), they are ignored like in history files.
+ */
+template <typename THandler>
+class VisibleHandler : public osmium::handler::Handler {
+
+    THandler& m_handler;
+
+public:
+
+    explicit VisibleHandler(THandler& handler) noexcept :
+        m_handler(handler) {
+    }
+
+    void node(const osmium::Node& node) {
+        if (node.visible()) {
+            m_handler.node(node);
+        }
+    }
+
+    void way(const osmium::Way& way) {
+        if (way.visible()) {
+            m_handler.way(way);
+        }
+    }
+
+    void relation(const osmium::Relation& relation) {
+        if (relation.visible()) {
+            m_handler.relation(relation);
+        }
+    }
+
+}; // VisibleHandler
+
+/**
+ * Read region configurations from a file. Each line contains the name of
+ * the database and the bounding box (left, bottom, right, top) separated
+ * by spaces. Empty lines and lines starting with '#' are ignored.
+ */
+static std::vector<region_config> read_region_configs(const std::string& filename) {
+    std::ifstream file{filename};
+    if (!file) {
+        throw std::runtime_error{"Can not open regions file '" + filename + "'"};
+    }
+
+    std::vector<region_config> configs;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream ss{line};
+        std::string database_name;
+        std::string left;
+        std::string bottom;
+        std::string right;
+        std::string top;
+        if (!(ss >> database_name >> left >> bottom >> right >> top)) {
+            throw std::runtime_error{"Invalid line in regions file '" + filename + "': " + line};
+        }
+        configs.push_back(region_config{database_name,
+                                        get_coordinate(left.c_str(), 180.0),
+                                        get_coordinate(bottom.c_str(), 90.0),
+                                        get_coordinate(right.c_str(), 180.0),
+                                        get_coordinate(top.c_str(), 90.0)});
+    }
+
+    return configs;
+}
+
+/**
+ * Run the checks otherwise done by taginfo-similarity and taginfo-unicode
+ * on the keys we already have in memory.
+ */
+static void check_keys(osmium::util::VerboseOutput& vout, Sqlite::Database& db, const TagStatsHandler& handler,
+                       bool find_similar_keys, bool find_unusual_characters, unsigned int num_threads) {
+    if (!find_similar_keys && !find_unusual_characters) {
+        return;
+    }
+
+    const auto keys = handler.sorted_keys();
+    db.begin_transaction();
+
+    if (find_similar_keys) {
+        vout << "Finding similar keys...\n";
+        string_list list;
+        for (const char* key : keys) {
+            list.add(key);
+        }
+        write_similar_keys(db, list, num_threads);
+    }
+
+    if (find_unusual_characters) {
+        vout << "Finding unusual characters in keys...\n";
+        text_batch batch;
+        for (const char* key : keys) {
+            batch.add(key);
+        }
+        find_unicode_info(db, batch, false, num_threads);
+    }
+
+    db.commit();
+}
+
 int main(int argc, char* argv[]) {
     static const option long_options[] = {
         {"help",                      no_argument,       nullptr, 'H'},
+        {"cell-index",                required_argument, nullptr, 'c'},
         {"index",                     required_argument, nullptr, 'i'},
         {"show-index-types",          no_argument,       nullptr, 'I'},
+        {"min-key-combination-count", required_argument, nullptr, 'k'},
+        {"write-cell-index",          required_argument, nullptr, 'o'},
         {"min-tag-combination-count", required_argument, nullptr, 'm'},
+        {"prune-tag-combinations",    no_argument,       nullptr, 'P'},
+        {"regions",                   required_argument, nullptr, 'R'},
         {"selection-db",              required_argument, nullptr, 's'},
+        {"similarity",                no_argument,       nullptr, 'S'},
+        {"unicode",                   no_argument,       nullptr, 'U'},
+        {"threads",                   required_argument, nullptr, 'T'},
         {"top",                       required_argument, nullptr, 't'},
         {"right",                     required_argument, nullptr, 'r'},
         {"bottom",                    required_argument, nullptr, 'b'},
         {"left",                      required_argument, nullptr, 'l'},
         {"width",                     required_argument, nullptr, 'w'},
         {"height",                    required_argument, nullptr, 'h'},
+        {"sketch-size",               required_argument, nullptr, 'z'},
         {nullptr, 0, nullptr, 0}
     };
 
     unsigned int min_tag_combination_count = 1000;
+    unsigned int min_key_combination_count = 0;
+    bool prune_tag_combinations = false;
+    std::size_t sketch_size = 256;
 
     std::string selection_database_name;
 
+    std::string regions_file_name;
+
     std::string index_type_name{"FlexMem"};
 
+    std::string cell_index_file_name;
+    std::string write_cell_index_file_name;
+
+    bool find_similar_keys = false;
+    bool find_unusual_characters = false;
+    unsigned int num_threads = 1;
+
     double top    =   90.0;
     double right  =  180.0;
     double bottom =  -90.0;
@@ -122,7 +298,7 @@ int main(int argc, char* argv[]) {
 
     while (true) {
         // NOLINTNEXTLINE(concurrency-mt-unsafe)
-        const int c = getopt_long(argc, argv, "Hi:Im:s:t:r:b:l:w:h:", long_options, nullptr);
+        const int c = getopt_long(argc, argv, "Hc:i:Ik:o:m:PR:s:SUT:t:r:b:l:w:h:z:", long_options, nullptr);
         if (c == -1) {
             break;
         }
@@ -131,6 +307,9 @@ int main(int argc, char* argv[]) {
             case 'H':
                 print_help();
                 return 0;
+            case 'c':
+                cell_index_file_name = optarg;
+                break;
             case 'i':
                 index_type_name = optarg;
                 break;
@@ -144,12 +323,36 @@ int main(int argc, char* argv[]) {
                 std::cout << "  SparseMmapArray\n";
 #endif
                 return 0;
+            case 'k':
+                min_key_combination_count = get_uint(optarg);
+                break;
+            case 'o':
+                write_cell_index_file_name = optarg;
+                break;
+            case 'R':
+                regions_file_name = optarg;
+                break;
             case 's':
                 selection_database_name = optarg;
                 break;
+            case 'S':
+                find_similar_keys = true;
+                break;
+            case 'U':
+                find_unusual_characters = true;
+                break;
+            case 'T':
+                num_threads = get_uint(optarg);
+                if (num_threads == 0) {
+                    num_threads = 1;
+                }
+                break;
             case 'm':
                 min_tag_combination_count = get_uint(optarg);
                 break;
+            case 'P':
+                prune_tag_combinations = true;
+                break;
             case 't':
                 top = get_coordinate(optarg, 90.0);
                 break;
@@ -168,6 +371,12 @@ int main(int argc, char* argv[]) {
             case 'h':
                 height = get_uint(optarg);
                 break;
+            case 'z':
+                sketch_size = get_uint(optarg);
+                if (sketch_size == 0) {
+                    sketch_size = 1;
+                }
+                break;
             default:
                 return 1;
         }
@@ -190,8 +399,19 @@ int main(int argc, char* argv[]) {
 
         MapToInt map_to_int{left, bottom, right, top, width, height};
 
-        const bool better_resolution = (width * height) >= (1U << 16U);
-        LocationIndex location_index{index_type_name, better_resolution};
+        std::vector<region_config> region_configs;
+        if (!regions_file_name.empty()) {
+            region_configs = read_region_configs(regions_file_name);
+        }
+
+        std::unique_ptr<LocationIndex> location_index;
+        if (cell_index_file_name.empty()) {
+            const bool better_resolution = (width * height) >= (1U << 16U);
+            location_index = LocationIndex::create(index_type_name, better_resolution);
+        } else {
+            vout << "Reading location cell index from '" << cell_index_file_name << "'\n";
+            location_index = LocationIndex::open(cell_index_file_name, map_to_int);
+        }
 
         osmium::io::Reader reader{input_file};
         const bool is_history = reader.header().has_multiple_object_versions();
@@ -202,12 +422,40 @@ int main(int argc, char* argv[]) {
             vout << "Input file is an OSM data file\n";
         }
 
-        TagStatsHandler tagstats_handler{db, selection_database_name, map_to_int, min_tag_combination_count, vout, location_index};
-        LastVersionHandler handler{tagstats_handler};
+        const auto sketch_width = CountMinSketch::width_for_size(sketch_size * 1024 * 1024);
+
+        TagStatsHandler tagstats_handler{db, selection_database_name, map_to_int, min_tag_combination_count, min_key_combination_count, vout, *location_index, prune_tag_combinations, sketch_width};
 
-        osmium::apply_diff(reader, handler);
+        RegionsHandler regions_handler{region_configs,
+                                       region_options{selection_database_name, index_type_name, min_tag_combination_count, min_key_combination_count, prune_tag_combinations, sketch_width, width, height},
+                                       vout};
+
+        if (is_history) {
+            LastVersionHandler<TagStatsHandler> handler{tagstats_handler};
+            LastVersionHandler<RegionsHandler> handler_for_regions{regions_handler};
+            osmium::apply_diff(reader, handler, handler_for_regions);
+        } else {
+            // All objects in a data file are the last version, so only
+            // deleted objects have to be filtered out.
+            VisibleHandler<TagStatsHandler> handler{tagstats_handler};
+            VisibleHandler<RegionsHandler> handler_for_regions{regions_handler};
+            osmium::apply(reader, handler, handler_for_regions);
+        }
 
         tagstats_handler.write_to_database();
+
+        if (!write_cell_index_file_name.empty()) {
+            vout << "Writing location cell index to '" << write_cell_index_file_name << "'\n";
+            location_index->write(write_cell_index_file_name, map_to_int);
+        }
+
+        check_keys(vout, db, tagstats_handler, find_similar_keys, find_unusual_characters, num_threads);
+
+        for (auto& region : regions_handler.regions()) {
+            vout << "Writing statistics for region '" << region->database_name() << "'\n";
+            region->handler().write_to_database();
+            check_keys(vout, region->database(), region->handler(), find_similar_keys, find_unusual_characters, num_threads);
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << '\n';
         return 2;
@@ -30,15 +30,68 @@
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <initializer_list>
 #include <iomanip>
 #include <iterator>
 #include <string>
 #include <utility>
+#include <vector>
+
+// Statements used for writing the results. They are all prepared once in
+// the constructor, so that a database without the right tables is noticed
+// before the input is read.
+static const char* const sql_insert_into_key_distributions =
+    "INSERT INTO key_distributions (key, object_type, png) VALUES (?, ?, ?);";
+
+static const char* const sql_insert_empty_key_distribution =
+    "INSERT INTO key_distributions (png) VALUES (?);";
+
+static const char* const sql_insert_into_tag_distributions =
+    "INSERT INTO tag_distributions (key, value, object_type, png) VALUES (?, ?, ?, ?);";
+
+static const char* const sql_insert_into_keys =
+    "INSERT INTO keys (key, " \
+    " count_all,  count_nodes,  count_ways,  count_relations, " \
+    "values_all, values_nodes, values_ways, values_relations, " \
+    " users_all, " \
+    "cells_nodes, cells_ways) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_insert_into_tags =
+    "INSERT INTO tags (key, value, " \
+    "count_all, count_nodes, count_ways, count_relations) " \
+    "VALUES (?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_insert_into_key_combinations =
+    "INSERT INTO key_combinations (key1, key2, " \
+    "count_all, count_nodes, count_ways, count_relations) " \
+    "VALUES (?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_insert_into_tag_combinations =
+    "INSERT INTO tag_combinations (key1, value1, key2, value2, " \
+    "count_all, count_nodes, count_ways, count_relations) " \
+    "VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_insert_into_relation_types =
+    "INSERT INTO relation_types (rtype, count, " \
+    "members_all, members_nodes, members_ways, members_relations) " \
+    "VALUES (?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_insert_into_relation_roles =
+    "INSERT INTO relation_roles (rtype, role, " \
+    "count_all, count_nodes, count_ways, count_relations) " \
+    "VALUES (?, ?, ?, ?, ?, ?);";
+
+static const char* const sql_update_meta =
+    "UPDATE source SET data_until=?";
+
+static const char* const sql_insert_into_stats =
+    "INSERT INTO stats (key, value) VALUES (?, ?);";
 
 struct split_result {
     const char* k;
@@ -113,6 +166,11 @@ static uint64_t show_string_store_memory_usage(osmium::util::VerboseOutput& out,
     return string_store.get_chunk_size() * chunk_count;
 }
 
+static uint64_t show_sketch_memory_usage(osmium::util::VerboseOutput& out, const CountMinSketch& sketch) {
+    out << std::setw(8) << (sketch.bytes_used() / 1024) << " kB\n";
+    return sketch.bytes_used();
+}
+
 static uint64_t show_location_index_memory_usage(osmium::util::VerboseOutput& out, const LocationIndex& location_index) {
     out << std::setw(8) << (location_index.used_memory() / 1024) << " kB ["
         << "size=" << location_index.size()
@@ -120,6 +178,51 @@ static uint64_t show_location_index_memory_usage(osmium::util::VerboseOutput& ou
     return location_index.used_memory();
 }
 
+/**
+ * Add combination of name (a key or tag) with other_name to the stats (a
+ * KeyStats or KeyValueStats object).
+ *
+ * If there is no sketch, all combinations are stored. Otherwise they are
+ * counted in the sketch first and only stored once they (probably) appear
+ * at least min_count times. From then on they are counted exactly.
+ *
+ * The sketch doesn't know the object types, the count from the sketch is
+ * used for the type of the object the combination is stored for. So the
+ * count for all objects is never too small (but can be too large because
+ * of collisions in the sketch), while the counts for the other types only
+ * include objects after the combination was stored.
+ */
+template <typename TStats>
+static void add_combination(TStats& stats,
+                            CountMinSketch* sketch,
+                            unsigned int min_count,
+                            const char* name,
+                            const char* other_name,
+                            osmium::item_type type) {
+    if (!sketch) {
+        stats.add_key_combination(other_name, type);
+        return;
+    }
+
+    if (stats.incr_key_combination(other_name, type)) {
+        return;
+    }
+
+    // The strings are in the string store, so their addresses identify
+    // them.
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto name_id = reinterpret_cast<uintptr_t>(name);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto other_id = reinterpret_cast<uintptr_t>(other_name);
+    const auto count = sketch->add(CountMinSketch::hash(name_id, other_id));
+
+    if (count >= min_count) {
+        Counter32 counter;
+        counter.set_count(type, count);
+        stats.set_key_combination(other_name, counter);
+    }
+}
+
 void TagStatsHandler::timer_info(const char* msg) {
     const auto duration = std::time(nullptr) - m_timer;
     m_vout << "  " << msg << " took " << duration << " seconds (about " << duration / 60 << " minutes)\n";
@@ -136,9 +239,9 @@ void TagStatsHandler::update_key_combination_hash(osmium::item_type type,
             const char* key2 = it2->key();
             const auto tsi2 = m_tags_stat.find(key2);
             if (std::strcmp(key1, key2) < 0) {
-                tsi1->second.add_key_combination(tsi2->first, type);
+                add_combination(tsi1->second, m_key_combination_sketch.get(), m_min_key_combination_count, tsi1->first, tsi2->first, type);
             } else {
-                tsi2->second.add_key_combination(tsi1->first, type);
+                add_combination(tsi2->second, m_key_combination_sketch.get(), m_min_key_combination_count, tsi2->first, tsi1->first, type);
             }
         }
     }
@@ -155,9 +258,9 @@ void TagStatsHandler::update_key_value_combination_hash2(osmium::item_type type,
         auto kvi2 = m_key_value_stats.find(key_value2.c_str());
         if (kvi2 != m_key_value_stats.end()) {
             if (key_value1 < key_value2) {
-                kvi1->second.add_key_combination(kvi2->first, type);
+                add_combination(kvi1->second, m_tag_combination_sketch.get(), m_min_tag_combination_count, kvi1->first, kvi2->first, type);
             } else {
-                kvi2->second.add_key_combination(kvi1->first, type);
+                add_combination(kvi2->second, m_tag_combination_sketch.get(), m_min_tag_combination_count, kvi2->first, kvi1->first, type);
             }
         }
 
@@ -167,9 +270,9 @@ void TagStatsHandler::update_key_value_combination_hash2(osmium::item_type type,
         kvi2 = m_key_value_stats.find(key_value2.c_str());
         if (kvi2 != m_key_value_stats.end()) {
             if (key_value1 < key_value2) {
-                kvi1->second.add_key_combination(kvi2->first, type);
+                add_combination(kvi1->second, m_tag_combination_sketch.get(), m_min_tag_combination_count, kvi1->first, kvi2->first, type);
             } else {
-                kvi2->second.add_key_combination(kvi1->first, type);
+                add_combination(kvi2->second, m_tag_combination_sketch.get(), m_min_tag_combination_count, kvi2->first, kvi1->first, type);
             }
         }
     }
@@ -199,8 +302,7 @@ void TagStatsHandler::update_key_value_combination_hash(osmium::item_type type,
 void TagStatsHandler::print_and_clear_key_distribution_images(osmium::item_type type) {
     int64_t sum_size = 0;
 
-    Sqlite::Statement statement_insert_into_key_distributions{m_database,
-        "INSERT INTO key_distributions (key, object_type, png) VALUES (?, ?, ?);"};
+    Sqlite::Statement statement_insert_into_key_distributions{m_database, sql_insert_into_key_distributions};
 
     m_database.begin_transaction();
 
@@ -230,8 +332,7 @@ void TagStatsHandler::print_and_clear_key_distribution_images(osmium::item_type
 void TagStatsHandler::print_and_clear_tag_distribution_images(osmium::item_type type) {
     int64_t sum_size = 0;
 
-    Sqlite::Statement statement_insert_into_tag_distributions{m_database,
-        "INSERT INTO tag_distributions (key, value, object_type, png) VALUES (?, ?, ?, ?);"};
+    Sqlite::Statement statement_insert_into_tag_distributions{m_database, sql_insert_into_tag_distributions};
     m_database.begin_transaction();
 
     const std::array<char, 2> object_type = { osmium::item_type_to_char(type), '\0' };
@@ -277,35 +378,29 @@ KeyStats& TagStatsHandler::get_stat(const char* key) {
 }
 
 void TagStatsHandler::collect_tag_stats(const osmium::OSMObject& object) {
+    // Find the grid cells covered by the object once for all its tags. For
+    // ways every cell is only in here once, even if several nodes are in it.
+    m_object_cells.clear();
+    if (object.type() == osmium::item_type::node) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-static-cast-downcast)
+        m_object_cells.push_back(m_map_to_int(static_cast<const osmium::Node&>(object).location()));
+    } else if (object.type() == osmium::item_type::way) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-static-cast-downcast)
+        m_way_nodes_without_cell += m_location_index.get_cells(static_cast<const osmium::Way&>(object).nodes(), m_object_cells);
+        std::sort(m_object_cells.begin(), m_object_cells.end());
+        m_object_cells.erase(std::unique(m_object_cells.begin(), m_object_cells.end()), m_object_cells.end());
+    }
+
     for (const auto& tag : object.tags()) {
         KeyStats& stat = get_stat(tag.key());
         stat.update(tag.value(), object, m_string_store);
 
-        const auto keyvalue = std::make_pair(tag.key(), tag.value());
-
-        if (object.type() == osmium::item_type::node) {
-            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-static-cast-downcast)
-            const auto location = m_map_to_int(static_cast<const osmium::Node&>(object).location());
-            stat.distribution().add_coordinate(location);
-            const auto gd_it = m_key_value_geodistribution.find(keyvalue);
-            if (gd_it != m_key_value_geodistribution.end()) {
-                gd_it->second.add_coordinate(location);
-            }
-        } else if (object.type() == osmium::item_type::way) {
-            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-static-cast-downcast)
-            const auto& wnl = static_cast<const osmium::Way&>(object).nodes();
-            if (!wnl.empty()) {
-                const auto gd_it = m_key_value_geodistribution.find(keyvalue);
-                for (const auto& wn : wnl) {
-                    try {
-                        const auto location = m_location_index.get(wn.positive_ref());
-                        stat.distribution().add_coordinate(location);
-                        if (gd_it != m_key_value_geodistribution.end()) {
-                            gd_it->second.add_coordinate(location);
-                        }
-                    } catch (const osmium::not_found&) {
-                        // node is missing for way: ignore
-                    }
+        if (!m_object_cells.empty()) {
+            const auto gd_it = m_key_value_geodistribution.find(std::make_pair(tag.key(), tag.value()));
+            for (const auto cell : m_object_cells) {
+                stat.distribution().add_coordinate(cell);
+                if (gd_it != m_key_value_geodistribution.end()) {
+                    gd_it->second.add_coordinate(cell);
                 }
             }
         }
@@ -321,18 +416,27 @@ TagStatsHandler::TagStatsHandler(Sqlite::Database& database,
         const std::string& selection_database_name,
         MapToInt& map_to_int,
         unsigned int min_tag_combination_count,
+        unsigned int min_key_combination_count,
         osmium::util::VerboseOutput& vout,
-        LocationIndex& location_index) :
+        LocationIndex& location_index,
+        bool prune_tag_combinations,
+        std::size_t sketch_width) :
     Handler(),
     m_vout(vout),
     m_min_tag_combination_count(min_tag_combination_count),
+    m_tag_combination_sketch(prune_tag_combinations ? std::make_unique<CountMinSketch>(sketch_width) : nullptr),
+    m_min_key_combination_count(min_key_combination_count),
+    m_key_combination_sketch(min_key_combination_count > 1 ? std::make_unique<CountMinSketch>(sketch_width) : nullptr),
     m_timer(std::time(nullptr)),
     m_string_store(string_store_size),
     m_database(database),
     m_statistics_handler(database),
     m_map_to_int(map_to_int),
-    m_location_index(location_index)
+    m_location_index(location_index),
+    m_set_locations(!location_index.read_only())
 {
+    check_database();
+
     if (!selection_database_name.empty()) {
         Sqlite::Database sdb{selection_database_name, SQLITE_OPEN_READONLY};
 
@@ -374,6 +478,17 @@ TagStatsHandler::TagStatsHandler(Sqlite::Database& database,
     m_timer = std::time(nullptr);
 }
 
+void TagStatsHandler::check_database() {
+    for (const char* sql : {sql_insert_into_key_distributions, sql_insert_empty_key_distribution,
+                            sql_insert_into_tag_distributions, sql_insert_into_keys,
+                            sql_insert_into_tags, sql_insert_into_key_combinations,
+                            sql_insert_into_tag_combinations, sql_insert_into_relation_types,
+                            sql_insert_into_relation_roles, sql_update_meta,
+                            sql_insert_into_stats}) {
+        const Sqlite::Statement statement{m_database, sql};
+    }
+}
+
 void TagStatsHandler::node(const osmium::Node& node) {
     if (m_max_timestamp < node.timestamp()) {
         m_max_timestamp = node.timestamp();
@@ -385,7 +500,28 @@ void TagStatsHandler::node(const osmium::Node& node) {
         collect_tag_stats(node);
     }
 
-    m_location_index.set(node.positive_id(), m_map_to_int(node.location()));
+    // All nodes go through the batch, so they are added to the location
+    // index in input order. The sparse index types need this, because
+    // lookups in them use a binary search.
+    if (m_set_locations) {
+        m_batch_ids.push_back(node.positive_id());
+        m_batch_locations.push_back(node.location());
+        if (m_batch_ids.size() == location_batch_size) {
+            flush_location_batch();
+        }
+    }
+}
+
+void TagStatsHandler::flush_location_batch() {
+    m_batch_cells.resize(m_batch_locations.size());
+    m_map_to_int(m_batch_locations.data(), m_batch_locations.size(), m_batch_cells.data());
+
+    for (std::size_t i = 0; i < m_batch_ids.size(); ++i) {
+        m_location_index.set(m_batch_ids[i], m_batch_cells[i]);
+    }
+
+    m_batch_ids.clear();
+    m_batch_locations.clear();
 }
 
 void TagStatsHandler::way(const osmium::Way& way) {
@@ -431,10 +567,11 @@ void TagStatsHandler::relation(const osmium::Relation& relation) {
 }
 
 void TagStatsHandler::before_ways() {
+    flush_location_batch();
     timer_info("processing nodes");
 
     auto png = GeoDistribution::create_empty_png();
-    Sqlite::Statement statement_insert_into_key_distributions{m_database, "INSERT INTO key_distributions (png) VALUES (?);"};
+    Sqlite::Statement statement_insert_into_key_distributions{m_database, sql_insert_empty_key_distribution};
     m_database.begin_transaction();
     statement_insert_into_key_distributions
         .bind_blob(png.data(), png.size()) // column: png
@@ -465,6 +602,7 @@ void TagStatsHandler::before_relations() {
 }
 
 void TagStatsHandler::write_to_database() {
+    flush_location_batch();
     timer_info("processing relations");
     print_actual_memory_usage();
 
@@ -472,38 +610,25 @@ void TagStatsHandler::write_to_database() {
     m_vout << "Writing results to database...\n";
     m_statistics_handler.write_to_database();
 
-    Sqlite::Statement statement_insert_into_keys{m_database, "INSERT INTO keys (key, " \
-            " count_all,  count_nodes,  count_ways,  count_relations, " \
-            "values_all, values_nodes, values_ways, values_relations, " \
-            " users_all, " \
-            "cells_nodes, cells_ways) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_insert_into_tags{m_database, "INSERT INTO tags (key, value, " \
-            "count_all, count_nodes, count_ways, count_relations) " \
-            "VALUES (?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_insert_into_key_combinations{m_database, "INSERT INTO key_combinations (key1, key2, " \
-            "count_all, count_nodes, count_ways, count_relations) " \
-            "VALUES (?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_insert_into_tag_combinations{m_database, "INSERT INTO tag_combinations (key1, value1, key2, value2, " \
-            "count_all, count_nodes, count_ways, count_relations) " \
-            "VALUES (?, ?, ?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_insert_into_relation_types{m_database, "INSERT INTO relation_types (rtype, count, " \
-            "members_all, members_nodes, members_ways, members_relations) " \
-            "VALUES (?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_insert_into_relation_roles{m_database, "INSERT INTO relation_roles (rtype, role, " \
-            "count_all, count_nodes, count_ways, count_relations) " \
-            "VALUES (?, ?, ?, ?, ?, ?);"};
-
-    Sqlite::Statement statement_update_meta{m_database, "UPDATE source SET data_until=?"};
+    Sqlite::Statement statement_insert_into_keys{m_database, sql_insert_into_keys};
+    Sqlite::Statement statement_insert_into_tags{m_database, sql_insert_into_tags};
+    Sqlite::Statement statement_insert_into_key_combinations{m_database, sql_insert_into_key_combinations};
+    Sqlite::Statement statement_insert_into_tag_combinations{m_database, sql_insert_into_tag_combinations};
+    Sqlite::Statement statement_insert_into_relation_types{m_database, sql_insert_into_relation_types};
+    Sqlite::Statement statement_insert_into_relation_roles{m_database, sql_insert_into_relation_roles};
+    Sqlite::Statement statement_update_meta{m_database, sql_update_meta};
+    Sqlite::Statement statement_insert_into_stats{m_database, sql_insert_into_stats};
 
     m_database.begin_transaction();
 
     statement_update_meta.bind_text(time_string(m_max_timestamp)).execute();
 
+    m_vout << "Nodes of tagged ways without cell (not in input or outside bounding box): " << m_way_nodes_without_cell << '\n';
+    statement_insert_into_stats
+        .bind_text("way_nodes_without_cell")                        // column: key
+        .bind_int64(static_cast<int64_t>(m_way_nodes_without_cell)) // column: value
+        .execute();
+
     uint64_t values_hash_size = 0;
     uint64_t values_hash_buckets = 0;
 
@@ -552,14 +677,16 @@ void TagStatsHandler::write_to_database() {
         key_combination_hash_buckets += stat.key_combination_hash().bucket_count();
 
         for (const auto& key_combo_stat : stat.key_combination_hash()) {
-            statement_insert_into_key_combinations
-                .bind_text(key_stat.first)                     // column: key1
-                .bind_text(key_combo_stat.first)               // column: key2
-                .bind_int64(key_combo_stat.second.all())       // column: count_all
-                .bind_int64(key_combo_stat.second.nodes())     // column: count_nodes
-                .bind_int64(key_combo_stat.second.ways())      // column: count_ways
-                .bind_int64(key_combo_stat.second.relations()) // column: count_relations
-                .execute();
+            if (key_combo_stat.second.all() >= m_min_key_combination_count) {
+                statement_insert_into_key_combinations
+                    .bind_text(key_stat.first)                     // column: key1
+                    .bind_text(key_combo_stat.first)               // column: key2
+                    .bind_int64(key_combo_stat.second.all())       // column: count_all
+                    .bind_int64(key_combo_stat.second.nodes())     // column: count_nodes
+                    .bind_int64(key_combo_stat.second.ways())      // column: count_ways
+                    .bind_int64(key_combo_stat.second.relations()) // column: count_relations
+                    .execute();
+            }
         }
     }
 
@@ -640,6 +767,16 @@ void TagStatsHandler::write_to_database() {
     m_vout << "  location_index: .......... ";
     total += show_location_index_memory_usage(m_vout, m_location_index);
 
+    if (m_key_combination_sketch) {
+        m_vout << "  key_combination_sketch: .. ";
+        total += show_sketch_memory_usage(m_vout, *m_key_combination_sketch);
+    }
+
+    if (m_tag_combination_sketch) {
+        m_vout << "  tag_combination_sketch: .. ";
+        total += show_sketch_memory_usage(m_vout, *m_tag_combination_sketch);
+    }
+
     m_vout << "  ======================================\n";
     m_vout << "  total: ................... " << std::setw(8) << (total / 1024) << " kB\n";
 
@@ -648,3 +785,16 @@ void TagStatsHandler::write_to_database() {
     m_vout << "------------------------------------------------------------------------------\n";
 }
 
+std::vector<const char*> TagStatsHandler::sorted_keys() const {
+    std::vector<const char*> keys;
+    keys.reserve(m_tags_stat.size());
+    for (const auto& key_stat : m_tags_stat) {
+        keys.push_back(key_stat.first);
+    }
+
+    std::sort(keys.begin(), keys.end(), [](const char* a, const char* b) {
+        return std::strcmp(a, b) < 0;
+    });
+
+    return keys;
+}
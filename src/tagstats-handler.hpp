@@ -22,95 +22,25 @@
 */
 
 #include "geodistribution.hpp"
+#include "count-min-sketch.hpp"
 #include "hash.hpp"
+#include "location-index.hpp"
 #include "statistics-handler.hpp"
 #include "string-store.hpp"
 
 #include <osmium/handler.hpp>
-#include <osmium/index/map/dense_mem_array.hpp>
-#include <osmium/index/map/dense_mmap_array.hpp>
-#include <osmium/index/map/flex_mem.hpp>
-#include <osmium/index/map/sparse_mem_array.hpp>
-#include <osmium/index/map/sparse_mmap_array.hpp>
 #include <osmium/index/nwr_array.hpp>
 #include <osmium/util/memory.hpp>
 #include <osmium/util/verbose_output.hpp>
 
 #include <absl/container/flat_hash_map.h>
 
-#include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
-
-/**
- * Stores the location of nodes. Lookup is by node ID.
- *
- * Locations are stored with reduced resolution, either in 16 bit or 32 bit.
- * The bool better_resolution on the constructor decides which is used.
- */
-class LocationIndex {
-
-    template <typename T>
-    using map_type = osmium::index::map::Map<osmium::unsigned_object_id_type, T>;
-
-    std::unique_ptr<map_type<uint16_t>> m_location_index_16bit{nullptr};
-    std::unique_ptr<map_type<uint32_t>> m_location_index_32bit{nullptr};
-
-    template <typename T>
-    static std::unique_ptr<map_type<T>> create_map(const std::string& location_index_type) {
-        osmium::index::register_map<osmium::unsigned_object_id_type, T, osmium::index::map::DenseMemArray>("FlexMem");
-        osmium::index::register_map<osmium::unsigned_object_id_type, T, osmium::index::map::DenseMemArray>("DenseMemArray");
-        osmium::index::register_map<osmium::unsigned_object_id_type, T, osmium::index::map::SparseMemArray>("SparseMemArray");
-#ifdef __linux__
-        osmium::index::register_map<osmium::unsigned_object_id_type, T, osmium::index::map::DenseMmapArray>("DenseMmapArray");
-        osmium::index::register_map<osmium::unsigned_object_id_type, T, osmium::index::map::SparseMmapArray>("SparseMmapArray");
-#endif
-        const auto& map_factory = osmium::index::MapFactory<osmium::unsigned_object_id_type, T>::instance();
-        return map_factory.create_map(location_index_type);
-    }
-
-public:
-
-    LocationIndex(const std::string& index_type_name, bool better_resolution) {
-        if (better_resolution) {
-            m_location_index_32bit = create_map<uint32_t>(index_type_name);
-        } else {
-            m_location_index_16bit = create_map<uint16_t>(index_type_name);
-        }
-    }
-
-    void set(osmium::unsigned_object_id_type id, uint32_t value) {
-        if (value == std::numeric_limits<uint32_t>::max()) {
-            return;
-        }
-        if (m_location_index_16bit) {
-            assert(value <= std::numeric_limits<uint16_t>::max());
-            m_location_index_16bit->set(id, static_cast<uint16_t>(value));
-        } else {
-            m_location_index_32bit->set(id, value);
-        }
-    }
-
-    uint32_t get(osmium::unsigned_object_id_type id) const {
-        return m_location_index_16bit ? static_cast<uint32_t>(m_location_index_16bit->get(id))
-                                      : m_location_index_32bit->get(id);
-    }
-
-    size_t size() const noexcept {
-        return m_location_index_16bit ? m_location_index_16bit->size()
-                                      : m_location_index_32bit->size();
-    }
-
-    size_t used_memory() const noexcept {
-        return m_location_index_16bit ? m_location_index_16bit->used_memory()
-                                      : m_location_index_32bit->used_memory();
-    }
-
-}; // class LocationIndex
-
+#include <vector>
 
 /**
  * Holds some counter for nodes, ways, and relations.
@@ -240,6 +170,23 @@ public:
         m_key_combination_hash[other_key].incr(type);
     }
 
+    /**
+     * Like add_key_combination(), but only if the combination is already
+     * stored. Returns false if it isn't.
+     */
+    bool incr_key_combination(const char* other_key, osmium::item_type type) {
+        const auto it = m_key_combination_hash.find(other_key);
+        if (it == m_key_combination_hash.end()) {
+            return false;
+        }
+        it->second.incr(type);
+        return true;
+    }
+
+    void set_key_combination(const char* other_key, const Counter32& counter) {
+        m_key_combination_hash[other_key] = counter;
+    }
+
 }; // class KeyStats
 
 using key_hash_map_type = absl::flat_hash_map<const char*, KeyStats, djb2_hash, eqstr>;
@@ -261,6 +208,23 @@ public:
         m_key_value_combination_hash[other_key].incr(type);
     }
 
+    /**
+     * Like add_key_combination(), but only if the combination is already
+     * stored. Returns false if it isn't.
+     */
+    bool incr_key_combination(const char* other_key, osmium::item_type type) {
+        const auto it = m_key_value_combination_hash.find(other_key);
+        if (it == m_key_value_combination_hash.end()) {
+            return false;
+        }
+        it->second.incr(type);
+        return true;
+    }
+
+    void set_key_combination(const char* other_key, const Counter32& counter) {
+        m_key_value_combination_hash[other_key] = counter;
+    }
+
 }; // class KeyValueStats
 
 using key_value_hash_map_type = absl::flat_hash_map<const char*, KeyValueStats, djb2_hash, eqstr>;
@@ -312,6 +276,26 @@ class TagStatsHandler : public osmium::handler::Handler {
      */
     unsigned int m_min_tag_combination_count;
 
+    /**
+     * If this is set, tag combinations are only stored once they (probably)
+     * appear at least m_min_tag_combination_count times. Until then they
+     * are counted in this sketch.
+     */
+    std::unique_ptr<CountMinSketch> m_tag_combination_sketch;
+
+    /**
+     * Key combination not appearing at least this often are not written
+     * to database.
+     */
+    unsigned int m_min_key_combination_count;
+
+    /**
+     * If there is a minimum count for key combinations, they are only
+     * stored once they (probably) appear that often. Until then they are
+     * counted in this sketch.
+     */
+    std::unique_ptr<CountMinSketch> m_key_combination_sketch;
+
     time_t m_timer;
 
     key_hash_map_type m_tags_stat;
@@ -336,8 +320,26 @@ class TagStatsHandler : public osmium::handler::Handler {
 
     LocationIndex& m_location_index;
 
+    // Set node locations in the index? Not if it was read from a file.
+    bool m_set_locations;
+
+    // Nodes whose locations have not been added to the location
+    // index yet. They are mapped to cells in batches of this size.
+    static constexpr const std::size_t location_batch_size = 1024;
+    std::vector<osmium::unsigned_object_id_type> m_batch_ids;
+    std::vector<osmium::Location> m_batch_locations;
+    std::vector<uint32_t> m_batch_cells;
+
     osmium::item_type m_last_type = osmium::item_type::node;
 
+    // Grid cells covered by the object currently being processed. Kept as
+    // member so the memory can be reused.
+    std::vector<uint32_t> m_object_cells;
+
+    // Number of nodes of tagged ways without a cell in the location index,
+    // because they are not in the input or outside the bounding box.
+    uint64_t m_way_nodes_without_cell = 0;
+
     void timer_info(const char* msg);
 
     void update_key_combination_hash(osmium::item_type type,
@@ -363,14 +365,28 @@ class TagStatsHandler : public osmium::handler::Handler {
     KeyStats& get_stat(const char* key);
     void collect_tag_stats(const osmium::OSMObject& object);
 
+    /**
+     * Prepare all statements used for writing the results.
+     *
+     * @throws Sqlite::Exception if the database doesn't have the tables
+     *         needed.
+     */
+    void check_database();
+
 public:
 
+    /// Default number of counters per row of the sketches (256 MB each).
+    static constexpr const std::size_t default_sketch_width = 1U << 24U;
+
     TagStatsHandler(Sqlite::Database& database,
                     const std::string& selection_database_name,
                     MapToInt& map_to_int,
                     unsigned int min_tag_combination_count,
+                    unsigned int min_key_combination_count,
                     osmium::util::VerboseOutput& vout,
-                    LocationIndex& location_index);
+                    LocationIndex& location_index,
+                    bool prune_tag_combinations = false,
+                    std::size_t sketch_width = default_sketch_width);
 
     void node(const osmium::Node& node);
 
@@ -378,11 +394,23 @@ public:
 
     void relation(const osmium::Relation& relation);
 
+    /**
+     * Add the locations of all nodes seen so far to the location index.
+     * This is done automatically before the first way is processed.
+     */
+    void flush_location_batch();
+
     void before_ways();
 
     void before_relations();
 
     void write_to_database();
 
+    /**
+     * Return all keys sorted in the same order as SQLite sorts them. The
+     * pointers stay valid as long as the handler exists.
+     */
+    std::vector<const char*> sorted_keys() const;
+
 }; // class TagStatsHandler
 
@@ -0,0 +1,388 @@
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "parallel.hpp"
+#include "unicode.hpp"
+
+#include <unicode/schriter.h>
+#include <unicode/uchar.h>
+#include <unicode/unistr.h>
+#include <unicode/utf8.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static const char* category_to_string(int8_t category) noexcept {
+    switch (category) {
+        // letters
+        case  1: return "Lu"; // uppercase letter
+        case  2: return "Ll"; // lowercase letter
+        case  3: return "Lt"; // titlecase letter
+        case  4: return "Lm"; // modifier letter
+        case  5: return "Lo"; // other letter
+        // marks
+        case  6: return "Mn"; // non-spacing mark
+        case  7: return "Me"; // enclosing mark
+        case  8: return "Mc"; // combining spacing mark
+        // numbers
+        case  9: return "Nd"; // decimal digit number
+        case 10: return "Nl"; // letter number
+        case 11: return "No"; // other number
+        // separators
+        case 12: return "Zs"; // space separator
+        case 13: return "Zl"; // line separator
+        case 14: return "Zp"; // paragraph separator
+        // control characters etc.
+        case 15: return "Cc"; // control char
+        case 16: return "Cf"; // format char
+        case 17: return "Co"; // private use char
+        case 18: return "Cs"; // surrogate
+        // punctuations
+        case 19: return "Pd"; // dash punctuation
+        case 20: return "Ps"; // start punctuation
+        case 21: return "Pe"; // end punctuation
+        case 22: return "Pc"; // connector punctuation
+        case 23: return "Po"; // other punctuation
+        // symbols
+        case 24: return "Sm"; // math symbol
+        case 25: return "Sc"; // currency symbol
+        case 26: return "Sk"; // modifier symbol
+        case 27: return "So"; // other symbol
+        // punctuations cont.
+        case 28: return "Pi"; // initial punctuation
+        case 29: return "Pf"; // final punctuation
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static std::array<bool, 256> make_plain_table() noexcept {
+    std::array<bool, 256> table{};
+    for (int c = 0; c < 128; ++c) {
+        table[c] = std::isalnum(c) || c == '_' || c == ':' || c == ' ' || c == '.' || c == '-';
+    }
+    return table;
+}
+
+/**
+ * Does the text (with the given length) only contain ASCII letters and
+ * digits and a few punctuation characters? With SSE2 this checks 16 bytes
+ * at once.
+ */
+static bool is_plain(const char* t, std::size_t len) noexcept {
+    static const std::array<bool, 256> plain_table = make_plain_table();
+
+    std::size_t i = 0;
+
+#ifdef __SSE2__
+    const auto in_range = [](__m128i v, char lo, char hi) noexcept {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+    };
+    const auto equal = [](__m128i v, char c) noexcept {
+        return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+    };
+
+    for (; i + 16 <= len; i += 16) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i));
+        __m128i ok = _mm_or_si128(_mm_or_si128(in_range(v, '0', '9'), in_range(v, 'A', 'Z')),
+                                  _mm_or_si128(in_range(v, 'a', 'z'), equal(v, '_')));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_or_si128(equal(v, ':'), equal(v, ' ')),
+                                           _mm_or_si128(equal(v, '.'), equal(v, '-'))));
+        if (_mm_movemask_epi8(ok) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < len; ++i) {
+        if (!plain_table[static_cast<unsigned char>(t[i])]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Properties of a code point as written into the key_characters table.
+ */
+struct codepoint_info {
+    std::string utf8;
+    std::string uplus;
+    int32_t block;
+    const char* category;
+    int direction;
+    std::string name;
+};
+
+/**
+ * Caches the properties of code points, so that ICU only has to be asked
+ * once for each code point, not for every time it appears in a key.
+ *
+ * is_unusual() can be called from several threads at the same time, info()
+ * can not.
+ */
+class codepoint_cache {
+
+    enum : uint8_t {
+        unknown = 0,
+        usual   = 1,
+        unusual = 2
+    };
+
+    // One entry for each code point, tells us whether it is unusual. If
+    // several threads look at the same unknown code point, they all
+    // calculate and store the same value, so relaxed access is enough.
+    std::vector<std::atomic<uint8_t>> m_unusual;
+
+    std::unordered_map<UChar32, codepoint_info> m_info;
+
+    static bool check_unusual(UChar32 codepoint) {
+        const int8_t chartype = u_charType(codepoint);
+        if (! u_isprint(codepoint)) {
+            return true;
+        }
+        if (u_charDirection(codepoint) != 0) {
+            return true;
+        }
+        return chartype !=  1 && // UPPERCASE_LETTER
+               chartype !=  2 && // LOWERCASE_LETTER
+               chartype !=  9 && // DECIMAL_DIGIT_NUMBER
+               chartype != 12 && // SPACE_SEPARATOR
+               chartype != 19 && // DASH_PUNCTUATION
+               chartype != 22 && // CONNECTOR_PUNCTUATION
+               chartype != 23;   // OTHER_PUNCTUATION
+    }
+
+public:
+
+    codepoint_cache() :
+        m_unusual(UCHAR_MAX_VALUE + 1) {
+    }
+
+    bool is_unusual(UChar32 codepoint) {
+        auto& entry = m_unusual[codepoint];
+        auto state = entry.load(std::memory_order_relaxed);
+        if (state == unknown) {
+            state = check_unusual(codepoint) ? unusual : usual;
+            entry.store(state, std::memory_order_relaxed);
+        }
+        return state == unusual;
+    }
+
+    const codepoint_info& info(UChar32 codepoint) {
+        const auto it = m_info.find(codepoint);
+        if (it != m_info.end()) {
+            return it->second;
+        }
+
+        codepoint_info ci;
+
+        icu::UnicodeString{codepoint}.toUTF8String(ci.utf8);
+
+        // "U+" and 4 to 6 hex digits (code points go up to U+10ffff)
+        std::array<char, 10> uplus{};
+        const int uplus_len = snprintf(uplus.begin(), uplus.size(), "U+%04x", codepoint);
+        if (uplus_len < 6 || uplus_len > 8) {
+            throw std::runtime_error{"Unicode code point to hex conversion failed"};
+        }
+        ci.uplus = uplus.cbegin();
+
+        ci.block = u_getIntPropertyValue(codepoint, UCHAR_BLOCK);
+        ci.category = category_to_string(u_charType(codepoint));
+        ci.direction = u_charDirection(codepoint);
+
+        std::array<char, 100> buffer{};
+        UErrorCode errorCode = U_ZERO_ERROR;
+        u_charName(codepoint, U_UNICODE_CHAR_NAME, buffer.begin(), buffer.size(), &errorCode);
+        ci.name = buffer.cbegin();
+
+        return m_info.emplace(codepoint, std::move(ci)).first->second;
+    }
+
+}; // class codepoint_cache
+
+/**
+ * Does the UTF-8 text contain any unusual code points? Invalid UTF-8 is
+ * always unusual.
+ */
+static bool is_unusual(const char* text, std::size_t len, codepoint_cache& cache) {
+    const auto length = static_cast<int32_t>(len);
+    for (int32_t i = 0; i < length;) {
+        UChar32 codepoint = 0;
+        U8_NEXT(text, i, length, codepoint);
+        if (codepoint < 0 || cache.is_unusual(codepoint)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * One row for the characters table. The code point is the one at position
+ * num (counted in code points) in the text with index n in the batch.
+ */
+struct character_row {
+    std::size_t n;
+    int num;
+    UChar32 codepoint;
+};
+
+static void get_unicode_info(const text_batch& batch, std::size_t n, codepoint_cache& cache, std::vector<character_row>& rows) {
+    const char* text = batch.text(n);
+    const auto len = batch.length(n);
+
+    if (is_plain(text, len)) {
+        return;
+    }
+
+    if (!is_unusual(text, len, cache)) {
+        return;
+    }
+
+    const auto us = icu::UnicodeString::fromUTF8(text);
+
+    int num = 0;
+    for (icu::StringCharacterIterator it{us}; it.hasNext(); it.next32(), ++num) {
+        rows.push_back(character_row{n, num, it.current32()});
+    }
+}
+
+/**
+ * Writes rows into the key_characters or value_characters table. Rows are
+ * collected and written batch_size rows at a time with a single INSERT
+ * statement. The strings in the rows must stay valid until flush() is
+ * called.
+ */
+class character_writer {
+
+    static constexpr const std::size_t batch_size = 100;
+
+    struct pending_row {
+        const char* key;
+        const char* value;
+        int num;
+        const codepoint_info* info;
+    };
+
+    std::vector<pending_row> m_rows;
+    bool m_values;
+    Sqlite::Statement m_insert_one;
+    Sqlite::Statement m_insert_batch;
+
+    static std::string make_sql(bool values, std::size_t num_rows) {
+        std::string sql{values ? "INSERT INTO value_characters (key, value, num, utf8, codepoint, block, category, direction, name) VALUES "
+                               : "INSERT INTO key_characters (key, num, utf8, codepoint, block, category, direction, name) VALUES "};
+        for (std::size_t i = 0; i < num_rows; ++i) {
+            if (i > 0) {
+                sql += ", ";
+            }
+            sql += values ? "(?, ?, ?, ?, ?, ?, ?, ?, ?)" : "(?, ?, ?, ?, ?, ?, ?, ?)";
+        }
+        return sql;
+    }
+
+    void bind(Sqlite::Statement& statement, const pending_row& row) const {
+        statement.bind_text(row.key);
+        if (m_values) {
+            statement.bind_text(row.value);
+        }
+        statement.
+            bind_int(row.num).
+            bind_text(row.info->utf8).
+            bind_text(row.info->uplus).
+            bind_int(row.info->block).
+            bind_text(row.info->category).
+            bind_int(row.info->direction).
+            bind_text(row.info->name);
+    }
+
+public:
+
+    /**
+     * Write into the value_characters table if values is true, otherwise
+     * into the key_characters table.
+     */
+    character_writer(Sqlite::Database& db, bool values) :
+        m_values(values),
+        m_insert_one(db, make_sql(values, 1).c_str()),
+        m_insert_batch(db, make_sql(values, batch_size).c_str()) {
+        m_rows.reserve(batch_size);
+    }
+
+    void add(const char* key, const char* value, int num, const codepoint_info& info) {
+        m_rows.push_back(pending_row{key, value, num, &info});
+        if (m_rows.size() == batch_size) {
+            for (const auto& row : m_rows) {
+                bind(m_insert_batch, row);
+            }
+            m_insert_batch.execute();
+            m_rows.clear();
+        }
+    }
+
+    void flush() {
+        for (const auto& row : m_rows) {
+            bind(m_insert_one, row);
+            m_insert_one.execute();
+        }
+        m_rows.clear();
+    }
+
+}; // class character_writer
+
+void find_unicode_info(Sqlite::Database& db, const text_batch& batch, bool values, unsigned int num_threads) {
+    constexpr const std::size_t chunk_size = 1024;
+
+    codepoint_cache cache;
+
+    std::vector<std::vector<character_row>> chunk_rows(batch.size() / chunk_size + 1);
+    run_in_chunks(batch.size(), chunk_size, num_threads, [&](std::size_t begin, std::size_t end, std::size_t chunk) {
+        for (std::size_t n = begin; n < end; ++n) {
+            get_unicode_info(batch, n, cache, chunk_rows[chunk]);
+        }
+    });
+
+    character_writer writer{db, values};
+    for (const auto& rows : chunk_rows) {
+        for (const auto& row : rows) {
+            writer.add(batch.key(row.n), batch.text(row.n), row.num, cache.info(row.codepoint));
+        }
+    }
+
+    writer.flush();
+}
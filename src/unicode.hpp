@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+
+  Copyright (C) 2012-2024 Jochen Topf <jochen@topf.org>.
+
+  This file is part of Taginfo Tools.
+
+  Taginfo is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Taginfo is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Taginfo.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <sqlite.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * A batch of texts to check. All texts and keys are stored as
+ * null-terminated strings back to back in one buffer. Each text can have a
+ * key it belongs to, consecutive texts with the same key share one copy of
+ * the key.
+ */
+class text_batch {
+
+    struct entry {
+        std::size_t key;
+        std::size_t text;
+        std::size_t length;
+    };
+
+    std::string m_data;
+    std::vector<entry> m_entries;
+    std::size_t m_last_key = 0;
+
+    std::size_t add_string(const char* str) {
+        const auto offset = m_data.size();
+        m_data += str;
+        m_data += '\0';
+        return offset;
+    }
+
+public:
+
+    std::size_t size() const noexcept {
+        return m_entries.size();
+    }
+
+    void clear() {
+        m_data.clear();
+        m_entries.clear();
+    }
+
+    void add(const char* text) {
+        const auto offset = add_string(text);
+        m_entries.push_back(entry{offset, offset, m_data.size() - offset - 1});
+    }
+
+    void add(const char* key, const char* text) {
+        if (m_entries.empty() || std::strcmp(key, m_data.c_str() + m_last_key) != 0) {
+            m_last_key = add_string(key);
+        }
+        const auto offset = add_string(text);
+        m_entries.push_back(entry{m_last_key, offset, m_data.size() - offset - 1});
+    }
+
+    const char* key(std::size_t n) const noexcept {
+        return m_data.c_str() + m_entries[n].key;
+    }
+
+    const char* text(std::size_t n) const noexcept {
+        return m_data.c_str() + m_entries[n].text;
+    }
+
+    std::size_t length(std::size_t n) const noexcept {
+        return m_entries[n].length;
+    }
+
+}; // class text_batch
+
+/**
+ * Find unusual characters in all texts in the batch using num_threads
+ * threads and write information about them in the order of the texts into
+ * the key_characters table or, if values is true, into the
+ * value_characters table.
+ */
+void find_unicode_info(Sqlite::Database& db, const text_batch& batch, bool values, unsigned int num_threads);
@@ -1,6 +1,7 @@
 
 #include "util.hpp"
 
+#include <cstdio>
 #include <cstdlib>
 #include <limits>
 #include <stdexcept>
@@ -35,6 +36,29 @@ unsigned int get_uint(const char* str) {
     return static_cast<unsigned int>(value);
 }
 
+int64_t get_date(const char* str) {
+    unsigned int year = 0;
+    unsigned int month = 0;
+    unsigned int day = 0;
+    int len = 0;
+
+    // NOLINTNEXTLINE(cert-err34-c)
+    if (std::sscanf(str, "%4u-%2u-%2u%n", &year, &month, &day, &len) != 3 ||
+        str[len] != '\0' || len != 10 || year < 1970 ||
+        month < 1 || month > 12 || day < 1) {
+        throw std::range_error{"invalid date"};
+    }
+
+    const civil_date date{year, month, day};
+    const auto days = days_from_civil(date);
+    const auto check = civil_from_days(days);
+    if (check.month != month || check.day != day) {
+        throw std::range_error{"invalid date"};
+    }
+
+    return days;
+}
+
 std::string time_string(osmium::Timestamp timestamp) {
     std::string ts{timestamp.to_iso_all()};
     assert(ts.size() > 10U);
@@ -43,3 +67,28 @@ std::string time_string(osmium::Timestamp timestamp) {
     return ts;
 }
 
+
+// The following two functions are based on the algorithms described in
+// https://howardhinnant.github.io/date_algorithms.html
+
+int64_t days_from_civil(const civil_date& date) noexcept {
+    const int64_t y = date.year - (date.month <= 2 ? 1 : 0);
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t mp = (date.month + 9) % 12;
+    const int64_t doy = (153 * mp + 2) / 5 + date.day - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+civil_date civil_from_days(int64_t days) noexcept {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const int64_t doe = days - era * 146097;
+    const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int64_t mp = (5 * doy + 2) / 153;
+    const auto day = static_cast<unsigned int>(doy - (153 * mp + 2) / 5 + 1);
+    const auto month = static_cast<unsigned int>(mp < 10 ? mp + 3 : mp - 9);
+    return civil_date{yoe + era * 400 + (month <= 2 ? 1 : 0), month, day};
+}
@@ -2,9 +2,20 @@
 
 #include <osmium/osm/timestamp.hpp>
 
+#include <cstdint>
 #include <string>
 
+struct civil_date {
+    int64_t year;
+    unsigned int month;
+    unsigned int day;
+};
+
 double get_coordinate(const char* str, double max);
 unsigned int get_uint(const char* str);
+int64_t get_date(const char* str);
 std::string time_string(osmium::Timestamp timestamp);
 
+int64_t days_from_civil(const civil_date& date) noexcept;
+civil_date civil_from_days(int64_t days) noexcept;
+
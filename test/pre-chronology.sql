@@ -0,0 +1,32 @@
+--
+--  Taginfo source: Chronology
+--
+--  pre-chronology.sql
+--
+
+INSERT INTO source (id, name, update_start) SELECT 'chronology', 'Chronology', datetime('now');
+
+DROP TABLE IF EXISTS keys_chronology;
+
+CREATE TABLE keys_chronology (
+  key       TEXT,
+  data      BLOB,
+  first_use INTEGER
+);
+
+DROP TABLE IF EXISTS tags_chronology;
+
+CREATE TABLE tags_chronology (
+  key       TEXT,
+  value     TEXT,
+  data      BLOB,
+  first_use INTEGER
+);
+
+DROP TABLE IF EXISTS keys_distinct_values_chronology;
+
+CREATE TABLE keys_distinct_values_chronology (
+  key  TEXT,
+  data BLOB
+);
+
@@ -59,6 +59,17 @@ CREATE TABLE similar_keys (
   similarity INTEGER
 );
 
+DROP TABLE IF EXISTS similar_values;
+
+CREATE TABLE similar_values (
+  key        VARCHAR,
+  value1     VARCHAR,
+  value2     VARCHAR,
+  count_all1 INTEGER DEFAULT 0,
+  count_all2 INTEGER DEFAULT 0,
+  similarity INTEGER
+);
+
 
 DROP TABLE IF EXISTS tag_distributions;
 
@@ -150,3 +161,17 @@ CREATE TABLE key_characters (
   name      TEXT
 );
 
+DROP TABLE IF EXISTS value_characters;
+
+CREATE TABLE value_characters (
+  key       TEXT,
+  value     TEXT,
+  num       INTEGER,
+  utf8      TEXT,
+  codepoint TEXT,
+  block     INTEGER,
+  category  TEXT,
+  direction INTEGER,
+  name      TEXT
+);
+
@@ -0,0 +1,29 @@
+#!/bin/sh
+#-----------------------------------------------------------------------------
+
+. $1/test/init.sh
+
+set -x
+
+#-----------------------------------------------------------------------------
+
+DB=chronology.db
+
+# Version 2 has a value that is only used for part of a day
+cat >chronology.osh.opl <<'XEOF'
+n1 v1 dV c1 t2010-01-01T00:00:00Z i1 uu x1.0 y1.0 Tamenity=bench
+n1 v2 dV c2 t2010-01-01T12:00:00Z i1 uu x1.0 y1.0 Tamenity=table
+n1 v3 dV c3 t2010-02-01T00:00:00Z i1 uu x1.0 y1.0 Tamenity=bench
+XEOF
+
+rm -f $DB
+sqlite3 $DB <${SRC_DIR}/test/init.sql
+sqlite3 $DB <${SRC_DIR}/test/pre-chronology.sql
+${BIN_DIR}/src/taginfo-chronology --distinct-values --granularity=month chronology.osh.opl $DB
+
+test amenity = $(sqlite3 $DB 'SELECT key FROM keys_chronology')
+
+# Two distinct values starting 2010-01-01 (day 14610)
+test 1239000002000000 = $(sqlite3 $DB "SELECT hex(data) FROM keys_distinct_values_chronology WHERE key = 'amenity'")
+
+#-----------------------------------------------------------------------------
@@ -17,4 +17,20 @@ sqlite3 $DB 'SELECT key, value FROM stats ORDER BY key' >$DB.stats.dump
 
 diff -u $DB.stats.dump ${SRC_DIR}/test/t/stats.stats.dump
 
+# Same results with several threads
+rm -f $DB
+${BIN_DIR}/src/osmstats --threads=3 $DATA $DB
+
+sqlite3 $DB 'SELECT key, value FROM stats ORDER BY key' >$DB.stats.dump
+
+diff -u $DB.stats.dump ${SRC_DIR}/test/t/stats.stats.dump
+
+# Without metadata there are no statistics about versions, users, and changesets
+rm -f $DB
+${BIN_DIR}/src/osmstats --no-metadata $DATA $DB
+
+sqlite3 $DB 'SELECT key, value FROM stats ORDER BY key' >$DB.stats.dump
+
+grep -v -E '^(max_user_id|anon_user_objects|(max|sum)_(node|way|relation)_version|max_changeset_id)[|]' ${SRC_DIR}/test/t/stats.stats.dump | diff -u $DB.stats.dump -
+
 #-----------------------------------------------------------------------------
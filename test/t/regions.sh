@@ -0,0 +1,56 @@
+#!/bin/sh
+#-----------------------------------------------------------------------------
+
+. $1/test/init.sh
+
+set -x
+
+#-----------------------------------------------------------------------------
+
+DATA=${SRC_DIR}/test/data.opl
+DB=regions.db
+
+rm -f $DB regions-world.db regions-small.db regions-corner.db
+for db in $DB regions-world.db regions-small.db regions-corner.db; do
+    sqlite3 $db <${SRC_DIR}/test/init.sql
+    sqlite3 $db <${SRC_DIR}/test/pre.sql
+done
+
+cat >regions.txt <<'EOF'
+# all data
+regions-world.db -180 -90 180 90
+
+# everything except the post box
+regions-small.db 1.5 1.5 3 3
+
+# only node 17, which is in the top left cell (cell 0)
+regions-corner.db 2.1 2.35 2.2 2.4000001
+EOF
+
+${BIN_DIR}/src/taginfo-stats --regions=regions.txt $DATA $DB
+
+KEYS='SELECT key, count_nodes, count_ways, count_relations, values_nodes, values_ways, values_relations, cells_nodes, cells_ways FROM keys ORDER BY key'
+
+sqlite3 $DB "$KEYS" >$DB.keys.dump
+diff -u $DB.keys.dump ${SRC_DIR}/test/t/stats.keys.dump
+
+sqlite3 regions-world.db "$KEYS" | diff -u $DB.keys.dump -
+
+test 0 = $(sqlite3 regions-small.db "SELECT count(*) FROM keys WHERE key = 'amenity'")
+test 2 = $(sqlite3 regions-small.db "SELECT count_ways FROM keys WHERE key = 'highway'")
+test 1 = $(sqlite3 regions-small.db "SELECT count_relations FROM keys WHERE key = 'type'")
+
+test 'highwy' = $(sqlite3 regions-corner.db "SELECT group_concat(key) FROM keys")
+test 1 = $(sqlite3 regions-corner.db "SELECT count_ways FROM keys WHERE key = 'highwy'")
+
+# Region databases without the tables are rejected before reading the input
+rm -f regions-empty.db
+echo 'regions-empty.db -180 -90 180 90' >regions-empty.txt
+if ${BIN_DIR}/src/taginfo-stats --regions=regions-empty.txt $DATA $DB >regions-empty.log 2>&1; then
+    exit 1
+fi
+if grep -q 'Processing ways' regions-empty.log; then
+    exit 1
+fi
+
+#-----------------------------------------------------------------------------
@@ -21,4 +21,25 @@ ${BIN_DIR}/src/taginfo-similarity $DB
 
 test "highway|highwy|1" = $(sqlite3 $DB 'SELECT key1, key2, similarity FROM similar_keys ORDER BY key1, key2')
 
+sqlite3 $DB "INSERT INTO tags (key, value, count_all) VALUES ('highway', 'residential', 5), ('highway', 'residental', 1), ('highwy', 'residental', 1);"
+
+# Keys with too many values are skipped
+${BIN_DIR}/src/taginfo-similarity --values=1 --max-values=3 $DB
+
+test 0 = $(sqlite3 $DB 'SELECT count(*) FROM similar_values')
+
+${BIN_DIR}/src/taginfo-similarity --values=1 $DB
+
+test "highway|residental|residential|1|5|1" = $(sqlite3 $DB 'SELECT key, value1, value2, count_all1, count_all2, similarity FROM similar_values ORDER BY key, value1, value2')
+
+# Similar keys can also be found by taginfo-stats directly
+DB=stats-similarity.db
+
+rm -f $DB
+sqlite3 $DB <${SRC_DIR}/test/init.sql
+sqlite3 $DB <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --similarity $DATA $DB
+
+test "highway|highwy|1" = $(sqlite3 $DB 'SELECT key1, key2, similarity FROM similar_keys ORDER BY key1, key2')
+
 #-----------------------------------------------------------------------------
@@ -17,13 +17,132 @@ ${BIN_DIR}/src/taginfo-stats $DATA $DB
 
 test 'db' = $(sqlite3 $DB 'SELECT id FROM source')
 
-sqlite3 $DB 'SELECT key, value FROM stats ORDER BY key' >$DB.stats.dump
+sqlite3 $DB "SELECT key, value FROM stats WHERE key != 'way_nodes_without_cell' ORDER BY key" >$DB.stats.dump
 diff -u $DB.stats.dump ${SRC_DIR}/test/t/stats.stats.dump
 
+test 0 = $(sqlite3 $DB "SELECT value FROM stats WHERE key = 'way_nodes_without_cell'")
+
 sqlite3 $DB 'SELECT key, count_nodes, count_ways, count_relations, values_nodes, values_ways, values_relations, cells_nodes, cells_ways FROM keys ORDER BY key' >$DB.keys.dump
 diff -u $DB.keys.dump ${SRC_DIR}/test/t/stats.keys.dump
 
 sqlite3 $DB 'SELECT key, value, count_nodes, count_ways, count_relations FROM tags ORDER BY key, value' >$DB.tags.dump
 diff -u $DB.tags.dump ${SRC_DIR}/test/t/stats.tags.dump
 
+# Same results when writing the location cell index and reading it again
+rm -f stats-cells.db stats.cells
+sqlite3 stats-cells.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-cells.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --write-cell-index=stats.cells $DATA stats-cells.db
+test -s stats.cells
+
+rm -f stats-cells.db
+sqlite3 stats-cells.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-cells.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --cell-index=stats.cells $DATA stats-cells.db
+
+sqlite3 stats-cells.db 'SELECT key, count_nodes, count_ways, count_relations, values_nodes, values_ways, values_relations, cells_nodes, cells_ways FROM keys ORDER BY key' | diff -u $DB.keys.dump -
+
+# The cell index can be rewritten to the file it was read from
+cp stats.cells stats-copy.cells
+rm -f stats-cells.db
+sqlite3 stats-cells.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-cells.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --cell-index=stats.cells --write-cell-index=stats.cells $DATA stats-cells.db
+cmp stats-copy.cells stats.cells
+
+# Same results with a sparse location index
+rm -f stats-sparse.db
+sqlite3 stats-sparse.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-sparse.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats -i SparseMemArray $DATA stats-sparse.db
+
+sqlite3 stats-sparse.db 'SELECT key, count_nodes, count_ways, count_relations, values_nodes, values_ways, values_relations, cells_nodes, cells_ways FROM keys ORDER BY key' | diff -u $DB.keys.dump -
+
+# Sparse location index works with tagged nodes between untagged nodes
+cat >stats-sparse.opl <<'EOF'
+n1 v1 dV c1 x2.0 y2.0
+n2 v1 dV c1 x3.0 y3.0 Tamenity=bench
+n3 v1 dV c1 x4.0 y4.0
+w10 v1 dV c1 Nn1,n2,n3 Thighway=path
+EOF
+
+rm -f stats-sparse.db
+sqlite3 stats-sparse.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-sparse.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats -i SparseMemArray stats-sparse.opl stats-sparse.db
+
+test 0 = $(sqlite3 stats-sparse.db "SELECT value FROM stats WHERE key = 'way_nodes_without_cell'")
+test 3 = $(sqlite3 stats-sparse.db "SELECT cells_ways FROM keys WHERE key = 'highway'")
+
+test 'highway|name|1|0|1|0' = $(sqlite3 $DB 'SELECT * FROM key_combinations')
+
+# Deleted objects are ignored
+cat >stats-deleted.opl <<'EOF'
+n1 v1 dV c1 x2.0 y2.0 Tamenity=bench
+n2 v2 dD c1 x3.0 y3.0 Tshop=bakery
+w10 v2 dD c1 Nn1 Thighway=path
+EOF
+
+rm -f stats-deleted.db
+sqlite3 stats-deleted.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-deleted.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats stats-deleted.opl stats-deleted.db
+
+test 'amenity' = $(sqlite3 stats-deleted.db 'SELECT group_concat(key) FROM keys')
+
+# Rare key combinations are not written
+rm -f stats-keycombo.db
+sqlite3 stats-keycombo.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-keycombo.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --min-key-combination-count=2 $DATA stats-keycombo.db
+
+test 0 = $(sqlite3 stats-keycombo.db 'SELECT count(*) FROM key_combinations')
+sqlite3 stats-keycombo.db 'SELECT key, count_nodes, count_ways, count_relations, values_nodes, values_ways, values_relations, cells_nodes, cells_ways FROM keys ORDER BY key' | diff -u $DB.keys.dump -
+
+# Same results when pruning tag combinations
+cat >stats-combinations.opl <<'EOF'
+n1 v1 dV c1 x1.0 y1.0 Tamenity=bench,backrest=yes
+n2 v1 dV c1 x1.0 y1.0 Tamenity=bench,backrest=no
+n3 v1 dV c1 x1.0 y1.0 Tamenity=bench,backrest=yes,material=wood
+w10 v1 dV c1 Nn1,n2 Tamenity=bench,backrest=yes
+EOF
+
+rm -f stats-selection.db
+sqlite3 stats-selection.db <<'EOF'
+CREATE TABLE interesting_tags (key TEXT, value TEXT);
+CREATE TABLE frequent_tags (key TEXT, value TEXT);
+CREATE TABLE interesting_relation_types (rtype TEXT);
+INSERT INTO interesting_tags (key, value) VALUES ('amenity', NULL), ('amenity', 'bench'), ('backrest', NULL), ('backrest', 'yes'), ('material', NULL);
+EOF
+
+TAG_COMBINATIONS='SELECT key1, value1, key2, value2, count_all, count_nodes, count_ways, count_relations FROM tag_combinations ORDER BY key1, value1, key2, value2'
+
+for db in stats-combinations.db stats-prune.db; do
+    rm -f $db
+    sqlite3 $db <${SRC_DIR}/test/init.sql
+    sqlite3 $db <${SRC_DIR}/test/pre.sql
+done
+
+${BIN_DIR}/src/taginfo-stats --selection-db=stats-selection.db --min-tag-combination-count=2 stats-combinations.opl stats-combinations.db
+${BIN_DIR}/src/taginfo-stats --selection-db=stats-selection.db --min-tag-combination-count=2 --prune-tag-combinations stats-combinations.opl stats-prune.db
+
+test 4 = $(sqlite3 stats-combinations.db 'SELECT count(*) FROM tag_combinations')
+sqlite3 stats-combinations.db "$TAG_COMBINATIONS" >stats-combinations.dump
+sqlite3 stats-prune.db "$TAG_COMBINATIONS" | diff -u stats-combinations.dump -
+
+# Key combinations appearing often enough are written with their counts
+test 3 = $(sqlite3 stats-combinations.db 'SELECT count(*) FROM key_combinations')
+
+rm -f stats-keycombo.db
+sqlite3 stats-keycombo.db <${SRC_DIR}/test/init.sql
+sqlite3 stats-keycombo.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --min-key-combination-count=2 --sketch-size=1 stats-combinations.opl stats-keycombo.db
+
+test 'amenity|backrest|4|3|1|0' = $(sqlite3 stats-keycombo.db 'SELECT * FROM key_combinations')
+
+# Cell index doesn't fit a different grid
+if ${BIN_DIR}/src/taginfo-stats --cell-index=stats.cells --width=720 --height=360 $DATA stats-cells.db; then
+    exit 1
+fi
+
 #-----------------------------------------------------------------------------
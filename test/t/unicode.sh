@@ -26,6 +26,31 @@ a❤b|2|b|U+0062|1|Ll|0|LATIN SMALL LETTER B
 a⧘b|0|a|U+0061|1|Ll|0|LATIN SMALL LETTER A
 a⧘b|1|⧘|U+29d8|105|Ps|10|LEFT WIGGLY FENCE
 a⧘b|2|b|U+0062|1|Ll|0|LATIN SMALL LETTER B
+a😀b|0|a|U+0061|1|Ll|0|LATIN SMALL LETTER A
+a😀b|1|😀|U+1f600|206|So|10|GRINNING FACE
+a😀b|2|b|U+0062|1|Ll|0|LATIN SMALL LETTER B
+EOF
+
+# Same results when taginfo-stats does the check directly
+rm -f unicode-stats.db
+sqlite3 unicode-stats.db <${SRC_DIR}/test/init.sql
+sqlite3 unicode-stats.db <${SRC_DIR}/test/pre.sql
+${BIN_DIR}/src/taginfo-stats --unicode $DATA unicode-stats.db
+
+sqlite3 unicode-stats.db 'SELECT * FROM key_characters ORDER BY key, num;' | diff -u unicode.dump -
+
+sqlite3 $DB "INSERT INTO tags (key, value) VALUES ('name', 'x❤');"
+sqlite3 $DB "INSERT INTO tags (key, value) VALUES ('name', 'y😀');"
+
+${BIN_DIR}/src/taginfo-unicode --values $DB
+
+sqlite3 $DB 'SELECT * FROM value_characters ORDER BY key, value, num;' >unicode-values.dump
+
+diff -u unicode-values.dump - <<'EOF'
+name|x❤|0|x|U+0078|1|Ll|0|LATIN SMALL LETTER X
+name|x❤|1|❤|U+2764|56|So|10|HEAVY BLACK HEART
+name|y😀|0|y|U+0079|1|Ll|0|LATIN SMALL LETTER Y
+name|y😀|1|😀|U+1f600|206|So|10|GRINNING FACE
 EOF
 
 #-----------------------------------------------------------------------------
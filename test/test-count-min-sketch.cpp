@@ -0,0 +1,50 @@
+
+#include "catch.hpp"
+
+#include "count-min-sketch.hpp"
+
+#include <cstdint>
+#include <vector>
+
+TEST_CASE("Empty CountMinSketch") {
+    const CountMinSketch sketch{1024};
+
+    CHECK(sketch.estimate(CountMinSketch::hash(1, 2)) == 0);
+    CHECK(sketch.bytes_used() == 4 * 1024 * sizeof(uint32_t));
+}
+
+TEST_CASE("Small CountMinSketch counts exactly") {
+    CountMinSketch sketch{1024};
+
+    const auto h1 = CountMinSketch::hash(1, 2);
+    const auto h2 = CountMinSketch::hash(2, 1);
+
+    CHECK(sketch.add(h1) == 1);
+    CHECK(sketch.add(h1) == 2);
+    CHECK(sketch.add(h2) == 1);
+
+    CHECK(sketch.estimate(h1) == 2);
+    CHECK(sketch.estimate(h2) == 1);
+}
+
+TEST_CASE("CountMinSketch never estimates too low") {
+    CountMinSketch sketch{64};
+
+    std::vector<uint32_t> counts(1000);
+    for (uint64_t i = 0; i < counts.size(); ++i) {
+        for (uint64_t n = 0; n < i % 17; ++n) {
+            sketch.add(CountMinSketch::hash(i, 0));
+            ++counts[i];
+        }
+    }
+
+    for (uint64_t i = 0; i < counts.size(); ++i) {
+        REQUIRE(sketch.estimate(CountMinSketch::hash(i, 0)) >= counts[i]);
+    }
+}
+
+TEST_CASE("CountMinSketch width for size") {
+    const CountMinSketch sketch{CountMinSketch::width_for_size(1024 * 1024)};
+
+    CHECK(sketch.bytes_used() == 1024 * 1024);
+}
@@ -0,0 +1,64 @@
+
+#include "catch.hpp"
+
+#include "hyperloglog.hpp"
+
+#include <string>
+
+TEST_CASE("Empty HyperLogLog") {
+    const HyperLogLog hll;
+
+    CHECK_FALSE(hll.dense());
+    CHECK(hll.estimate() == 0);
+}
+
+TEST_CASE("Small HyperLogLog counts exactly") {
+    HyperLogLog hll;
+
+    hll.add("residential");
+    hll.add("primary");
+    hll.add("residential");
+    hll.add("secondary");
+
+    CHECK_FALSE(hll.dense());
+    CHECK(hll.estimate() == 3);
+}
+
+TEST_CASE("Large HyperLogLog estimates count") {
+    HyperLogLog hll;
+
+    for (int i = 0; i < 100000; ++i) {
+        hll.add(std::to_string(i).c_str());
+    }
+
+    CHECK(hll.dense());
+    CHECK(hll.estimate() > 90000);
+    CHECK(hll.estimate() < 110000);
+}
+
+TEST_CASE("Merging HyperLogLogs") {
+    HyperLogLog hll1;
+    HyperLogLog hll2;
+    HyperLogLog all;
+
+    for (int i = 0; i < 3000; ++i) {
+        const auto str = std::to_string(i);
+        if (i % 2 == 0) {
+            hll1.add(str.c_str());
+        } else {
+            hll2.add(str.c_str());
+        }
+        all.add(str.c_str());
+    }
+
+    hll1.merge(hll2);
+    CHECK(hll1.estimate() == all.estimate());
+
+    HyperLogLog small;
+    small.add("foo");
+    small.add("bar");
+
+    HyperLogLog empty;
+    empty.merge(small);
+    CHECK(empty.estimate() == 2);
+}
@@ -0,0 +1,70 @@
+
+#include "catch.hpp"
+
+#include "geodistribution.hpp"
+
+#include <osmium/osm/location.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+TEST_CASE("MapToInt maps locations to cells") {
+    const MapToInt map_to_int{-180.0, -90.0, 180.0, 90.0, 360, 180};
+
+    CHECK(map_to_int(osmium::Location{-180.0, 89.5}) == 0);
+    CHECK(map_to_int(osmium::Location{0.0, 0.0}) == 90 * 360 + 180);
+    CHECK(map_to_int(osmium::Location{1.0, 0.0}) == 90 * 360 + 181);
+    CHECK(map_to_int(osmium::Location{0.9999999, 0.0}) == 90 * 360 + 180);
+    CHECK(map_to_int(osmium::Location{179.9999999, -90.0}) == 179 * 360 + 359);
+}
+
+TEST_CASE("MapToInt returns max value outside bounding box") {
+    const MapToInt map_to_int{5.0, 45.0, 10.0, 50.0, 100, 100};
+    constexpr const auto outside = std::numeric_limits<uint32_t>::max();
+
+    CHECK(map_to_int(osmium::Location{4.9999999, 47.0}) == outside);
+    CHECK(map_to_int(osmium::Location{10.0, 47.0}) == outside);
+    CHECK(map_to_int(osmium::Location{7.0, 50.0}) == outside);
+    CHECK(map_to_int(osmium::Location{}) == outside);
+    CHECK(map_to_int(osmium::Location{5.0, 45.0}) == 99 * 100);
+}
+
+TEST_CASE("MapToInt bounding box edges match comparing coordinates") {
+    // All these coordinates are rounded up when multiplied by 10^7
+    const MapToInt map_to_int{0.07, 1.11, 1.12, 2.22, 10, 10};
+    constexpr const auto outside = std::numeric_limits<uint32_t>::max();
+
+    CHECK(map_to_int(osmium::Location{0.07, 1.11}) == 9 * 10);
+    CHECK(map_to_int(osmium::Location{0.0699999, 1.11}) == outside);
+    CHECK(map_to_int(osmium::Location{0.07, 1.1099999}) == outside);
+    CHECK(map_to_int(osmium::Location{1.1199999, 2.2199999}) == 9);
+    CHECK(map_to_int(osmium::Location{1.12, 2.0}) == outside);
+    CHECK(map_to_int(osmium::Location{0.5, 2.22}) == outside);
+
+    for (int i = 1; i < 100000; i += 7) {
+        const double coordinate = i / 1000.0;
+        const MapToInt m{coordinate, 0.0, coordinate + 1.0, 1.0, 1, 1};
+        const osmium::Location edge{coordinate, 0.5};
+        REQUIRE(m.contains(edge) == (edge.lon() >= coordinate));
+    }
+}
+
+TEST_CASE("MapToInt maps batches of locations like single locations") {
+    const MapToInt map_to_int{-10.5, 40.25, 20.0, 60.0, 1000, 500};
+
+    std::vector<osmium::Location> locations;
+    for (int x = -120; x <= 210; x += 3) {
+        for (int y = 400; y <= 610; y += 7) {
+            locations.emplace_back(x / 10.0, y / 10.0);
+        }
+    }
+    locations.emplace_back();
+
+    std::vector<uint32_t> cells(locations.size());
+    map_to_int(locations.data(), locations.size(), cells.data());
+
+    for (std::size_t i = 0; i < locations.size(); ++i) {
+        REQUIRE(cells[i] == map_to_int(locations[i]));
+    }
+}
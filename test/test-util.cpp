@@ -26,3 +26,30 @@ TEST_CASE("Timestamp to string") {
     CHECK(time_string(ts) == "1970-01-01 00:00:01");
 }
 
+
+TEST_CASE("Valid dates for get_date") {
+    CHECK(get_date("1970-01-01") == 0);
+    CHECK(get_date("2007-10-07") == 13793);
+    CHECK(get_date("2024-02-29") == 19782);
+}
+
+TEST_CASE("Invalid dates for get_date") {
+    CHECK_THROWS(get_date(""));
+    CHECK_THROWS(get_date("foo"));
+    CHECK_THROWS(get_date("2007-10"));
+    CHECK_THROWS(get_date("2007-10-07x"));
+    CHECK_THROWS(get_date("2007-13-01"));
+    CHECK_THROWS(get_date("2023-02-29"));
+    CHECK_THROWS(get_date("1969-12-31"));
+}
+
+TEST_CASE("Conversion between days and dates") {
+    const auto date = civil_from_days(13793);
+    CHECK(date.year == 2007);
+    CHECK(date.month == 10);
+    CHECK(date.day == 7);
+
+    for (int64_t days = 0; days < 30000; days += 17) {
+        CHECK(days_from_civil(civil_from_days(days)) == days);
+    }
+}